@@ -21,6 +21,9 @@
 #include "2C02.h"
 #include "display.h"
 #include "memory.h"
+#if defined (COROUTINES)
+#include "coro.h"
+#endif
 
 // TODO:
 // update_xscroll() and update_yscroll()
@@ -43,7 +46,18 @@ make_ppu ()
     /* Allocate a PPU instance for a 2C02 PPU */
     ppu_inst* ppux = (ppu_inst*) malloc (sizeof(ppu_inst));
 
-    ppux->mmap = 0;
+    init_ppu (ppux);
+
+    /* Return the address of the allocated register file */
+    return ppux;
+}
+
+
+// Puts a PPU instance (wherever it lives) into its power-on state
+void
+init_ppu (ppu_inst* ppux)
+{
+    memset (ppux->mmap, 0, sizeof(ppux->mmap));
 
     ppux->PPUCTRL     = 0x0;
     ppux->PPUMASK     = 0x0;
@@ -64,10 +78,151 @@ make_ppu ()
     ppux->dodma = 0;
 
     ppux->OAM = 0;
+    ppux->TABLES = 0;
+    ppux->PALETTES = 0;
+    ppux->mirroring = 0;
     ppux->NMI = 0;
+    ppux->frame_ready = 0;
+    ppux->skip = 0;
+    ppux->SCROLL = 0;
+    ppux->latch = 0;
+    ppux->displayx = 0;
+
+    ppux->clock = 0;
+    ppux->cpux = 0;
+    ppux->a12_exact = 0;
+    ppux->a12 = 0;
+    ppux->a12_fell = 0;
+    ppux->chr_latch = 0;
+
+#if defined (COROUTINES)
+    ppux->coro = 0;
+    ppux->host = 0;
+    ppux->owed = 0;
+#endif
+}
 
-    /* Return the address of the allocated register file */
-    return ppux;
+
+void
+ppu_a12 (ppu_inst* ppux, int level)
+{
+    if (level) {
+        if (!ppux->a12 && (ppux->clock - ppux->a12_fell >= A12_FILTER)) {
+            ppux->cpux->mapper->a12 (ppux->cpux);
+        }
+        ppux->a12 = 1;
+    } else if (ppux->a12) {
+        ppux->a12 = 0;
+        ppux->a12_fell = ppux->clock;
+    }
+}
+
+
+// A12 of the pattern fetch made on this cycle of a rendered
+// scanline (-1 if the PPU is not fetching a pattern now).
+// Name/attribute fetches are at $2xxx, so A12 is low for them.
+static int
+fetch_a12 (ppu_inst* ppux)
+{
+    int c = ppux->linecycle;
+    int slot, i, row, height, n;
+
+    if ((c & 0x07) == 0) {
+        return 0;                       // name table fetch
+    } else if ((c & 0x07) != 4) {
+        return -1;
+    }
+
+    // background tiles (this line & the first 2 of the next)
+    if ((c < 256) || (c >= 320)) {
+        return (ppux->PPUCTRL & 0x10) ? 1 : 0;
+    }
+
+    // sprite tiles for the next scanline
+    if (!(ppux->PPUCTRL & 0x20)) {
+        return (ppux->PPUCTRL & 0x08) ? 1 : 0;
+    }
+
+    // 8x16 sprites pick their table by tile # bit 0, so find
+    // which sprite this slot holds (empty slots fetch tile $FF)
+    slot = (c - 260) / 8;
+    height = 16;
+    for (i=0, n=0; i<64; i++) {
+        row = ppux->scanline - ppux->OAM[4*i];
+        if ((row >= 0) && (row < height) && (n++ == slot)) {
+            return ppux->OAM[4*i + 1] & 0x01;
+        }
+    }
+    return 1;
+}
+
+
+// CHR latches (MMC2/MMC4) flip when the PPU fetches tile $FD or
+// $FE, and the new bank applies from the next fetch on.  The
+// renderer is per pixel, so rather than report every fetch the
+// row is split at tile boundaries: once a tile's last pixel is
+// out, only a latch tile goes on to the mapper.
+static void
+latch_bg (ppu_inst* ppux)
+{
+    word nt_addr;
+    word bm_addr;
+    byte tile;
+
+#if defined (scroll_v1)
+    word v = ppux->PPUADDR;
+#else
+    word v = ppux->SCROLL;
+#endif
+
+    // same tile render_scanline just drew from
+    nt_addr = 0x2000 | (ppux->PPUADDR & 0x0C00) | (v & 0x03FF);
+    tile = MMAP_BYTE (ppux->mmap, nt_addr);
+
+    if ((tile == 0xFD) || (tile == 0xFE)) {
+        bm_addr = (tile*16) + ((v & 0x7000) >> 12);
+        bm_addr |= (0x10 & ppux->PPUCTRL) << 8;
+        ppux->cpux->mapper->latch (ppux->cpux, bm_addr + 8);
+    }
+}
+
+
+// The sprite half of the above: pattern fetches for the (up to 8)
+// sprites on the next scanline, in OAM order.
+static void
+latch_sprites (ppu_inst* ppux)
+{
+    int i, n, row, height;
+    word bm_addr;
+    byte tile, attr;
+
+    height = (ppux->PPUCTRL & 0x20) ? 16 : 8;
+
+    for (i=0, n=0; (i<64) && (n<8); i++) {
+        row = ppux->scanline - ppux->OAM[4*i];
+        if ((row < 0) || (row >= height)) {
+            continue;
+        }
+        n++;
+
+        tile = ppux->OAM[4*i + 1];
+        attr = ppux->OAM[4*i + 2];
+        if (attr & 0x80) {
+            row = height - 1 - row;     // vertical flip
+        }
+
+        if (height == 16) {
+            bm_addr = (tile & 0x01) << 12;
+            tile = (tile & 0xFE) + (row >> 3);
+        } else {
+            bm_addr = (ppux->PPUCTRL & 0x08) << 9;
+        }
+
+        if ((tile == 0xFD) || (tile == 0xFE)) {
+            bm_addr |= (tile*16) + (row & 0x07);
+            ppux->cpux->mapper->latch (ppux->cpux, bm_addr + 8);
+        }
+    }
 }
 
 
@@ -240,16 +395,16 @@ render_scanline (ppu_inst* ppux)
     at_addr = nt_base + 0x03C0 + (8*(j/32)) + (i/32);
 
     // name & attribute table lookups
-    nt_byte = *ppux->mmap[nt_addr];
-    at_byte = *ppux->mmap[at_addr];
+    nt_byte = MMAP_BYTE (ppux->mmap, nt_addr);
+    at_byte = MMAP_BYTE (ppux->mmap, at_addr);
 
     // base index into pattern table
     bm_addr = (nt_byte*16) + (j%8);
     bm_addr |= (0x10 & ppux->PPUCTRL) << 3;
 
     // pattern table lookups
-    bitmap0 = *ppux->mmap[bm_addr + 0];
-    bitmap1 = *ppux->mmap[bm_addr + 8];
+    bitmap0 = MMAP_BYTE (ppux->mmap, bm_addr + 0);
+    bitmap1 = MMAP_BYTE (ppux->mmap, bm_addr + 8);
 
     // extract pixel from upper & lower bitmap bytes
     pal_bit0 = ((0x80 >> (i%8)) & bitmap0) >> (7-(i%8));
@@ -276,8 +431,10 @@ render_scanline (ppu_inst* ppux)
              | (pal_bit1  << 1)
              | (pal_bit23 << 2);
 
-    // update the display
-    displayx->pixels[256*y + x] = *ppux->mmap[pal_addr];
+    // update the display (9-bit pixel: color emphasis bits from
+    // PPUMASK on top of the 6-bit palette entry)
+    displayx->pixels[256*y + x] = (ppux->PALETTES[pal_addr & 0x1F] & 0x3F)
+                                | ((ppux->PPUMASK & 0xE0) << 1);
 }
 
 
@@ -285,6 +442,7 @@ int
 run_ppu (ppu_inst* ppux, int dcycles)
 {
     byte tmp;
+    int a12;
 
     while (dcycles > 0) {
 
@@ -311,7 +469,16 @@ run_ppu (ppu_inst* ppux, int dcycles)
         else if ((ppux->scanline >= 0) && (ppux->scanline < 240)) {
             if ((ppux->linecycle >= 0) && (ppux->linecycle < 256)) {
 
-                render_scanline (ppux);
+                if (!ppux->skip && ppux->displayx) {
+                    render_scanline (ppux);
+                }
+
+                // end of a tile (or of the partial one at the right
+                // edge): latch tiles switch CHR for what follows
+                if (ppux->chr_latch && (ppux->PPUMASK & 0x18) &&
+                    ((ppux->FINESCROLL == 7) || (ppux->linecycle == 255))) {
+                    latch_bg (ppux);
+                }
 
 #if defined (scroll_v1)
                 update_xscroll (ppux);
@@ -336,10 +503,28 @@ run_ppu (ppu_inst* ppux, int dcycles)
             }
         }
 
+        // A12 for cartridges that count its edges themselves
+        if (ppux->a12_exact && (ppux->scanline >= -1) &&
+            (ppux->scanline < 240) && (ppux->PPUMASK & 0x18)) {
+            a12 = fetch_a12 (ppux);
+            if (a12 >= 0) {
+                ppu_a12 (ppux, a12);
+            }
+        }
+
+        // Sprite fetches for CHR latches (done with by cycle 320)
+        if (ppux->chr_latch && (ppux->linecycle == 320) &&
+            (ppux->scanline >= -1) && (ppux->scanline < 240) &&
+            (ppux->PPUMASK & 0x18)) {
+            latch_sprites (ppux);
+        }
+
         // Update cycle counters
         ppux->linecycle++;
         dcycles--;
 
+        ppux->clock++;
+
         if (ppux->linecycle > 341) {
             ppux->linecycle = 0;    // Current cycle within scanline (of 341)
             ppux->scanline++;
@@ -357,13 +542,18 @@ run_ppu (ppu_inst* ppux, int dcycles)
                 // issue an NMI on VBLANK?
                 if (ppux->PPUCTRL & 0x80) {
                     ppux->NMI = 1;
+                    poll_interrupts (ppux->cpux);
 //                    printf ("issuing NMI\n");
                 }
 
                 // indicate we are in VBLANK
                 ppux->PPUSTATUS |= 0x80;
 
-                update_display (ppux->displayx);
+                if (!ppux->skip && ppux->displayx) {
+                    update_display (ppux->displayx);
+                }
+                ppux->frame_ready = 1;
+                schedule_event (ppux->cpux, EVENT_FRAME, ppux->clock);
             }
         }
 
@@ -372,3 +562,55 @@ run_ppu (ppu_inst* ppux, int dcycles)
     return dcycles;
 }
 
+
+#if defined (COROUTINES)
+// The PPU coroutine: runs the cycles the CPU got ahead by, then
+// hands back.  It never runs ahead of the CPU, so nothing the CPU
+// does can come too late for it.  (owed is cleared first: while
+// it runs, PPU_NOW is the PPU's own clock)
+static void
+ppu_thread (void *arg)
+{
+    ppu_inst* ppux = (ppu_inst*) arg;
+    int owed;
+
+    for (;;) {
+        owed = ppux->owed;
+        ppux->owed = 0;
+        run_ppu (ppux, owed);
+        coro_switch (ppux->coro, ppux->host);
+    }
+}
+
+
+void
+ppu_sync (ppu_inst* ppux)
+{
+    if (ppux->owed) {
+        if (!ppux->coro) {
+            ppux->host = make_coro (0, 0, 0);
+            ppux->coro = make_coro (ppu_thread, ppux, PPU_STACK_SIZE);
+        }
+        coro_switch (ppux->host, ppux->coro);
+    }
+
+    // The NMI & the end of the frame are raised by the PPU, so the
+    // CPU must stop & catch it up when it gets to the next vblank
+    // (the scanline wrap in run_ppu)
+    schedule_event (ppux->cpux, EVENT_PPU, ppux->clock
+                  + (240 - ppux->scanline) * PPU_LINE_CYCLES
+                  + (PPU_LINE_CYCLES - ppux->linecycle));
+}
+
+
+void
+destroy_ppu_coro (ppu_inst* ppux)
+{
+    if (ppux->coro) {
+        destroy_coro (ppux->coro);
+        destroy_coro (ppux->host);
+    }
+    ppux->coro = 0;
+    ppux->host = 0;
+}
+#endif
@@ -25,6 +25,39 @@
 // NOTE:
 // wo = write only, ro = read only, rw = read/write
 
+/* Frame timing: 262 scanlines (-21 ... 240) of 341+1 cycles */
+#define PPU_LINE_CYCLES     342
+#define PPU_FRAME_LINES     262
+#define PPU_FRAME_CYCLES    (PPU_LINE_CYCLES * PPU_FRAME_LINES)
+
+/* An event time that is never reached */
+#define PPU_NEVER           (~0ULL)
+
+/* The CPU's time on the PPU clock (with COROUTINES the PPU itself
+ * may be behind by the cycles it is owed) */
+#if defined (COROUTINES)
+#define PPU_NOW(ppux)       ((ppux)->clock + (ppux)->owed)
+#else
+#define PPU_NOW(ppux)       ((ppux)->clock)
+#endif
+
+/* A12 must be low this many PPU cycles for a rise to count (the
+ * MMC3 filters out the short dips between pattern fetches) */
+#define A12_FILTER      10
+
+#if defined (COROUTINES)
+/* The CPU may get this many PPU cycles ahead of the PPU before it
+ * hands over (I/O & mapper accesses always hand over first) */
+#define PPU_SYNC_WINDOW     24
+#define PPU_STACK_SIZE      (64*1024)
+#endif
+
+/* Defined in 6502.h */
+struct cpu_instance;
+
+/* Defined in coro.h */
+struct coro_instance;
+
 // A 2C02 PPU Instance
 typedef struct ppu_instance ppu_inst;
 struct ppu_instance {
@@ -34,9 +67,10 @@ struct ppu_instance {
     // the I/O block of the CPU memory map
     // (where all the PPU status and control
     // registers live).
-    byte** mmap;
+    byte* mmap[PPU_PAGES];
 
     // PPU needs access to the display
+    // (none for headless instances: nothing is rendered)
     disp_inst* displayx;
 
     /* Registers */
@@ -56,13 +90,31 @@ struct ppu_instance {
     word PPULATCH;      /* a.k.a Loopy_T     */
     byte FINESCROLL;    /* a.k.a Loopy_X     */
 //    byte PPUSCROLL;     /*      Scroll (wo)  */
+
+    /* Pixel/state Tracking (run_ppu checks these every cycle) */
+    int scanline;       /* Current scanline          */
+    int linecycle;      /* PPU cycle within scanline */
+    unsigned long long clock;       /* PPU cycles since power-on */
     
     /* Contains Sprite States */
     byte *OAM;
 
+    /* Memory behind the PPU map (see init_nes_memorymap) */
+    byte *TABLES;       /* Name/Attribute Tables */
+    byte *PALETTES;     /* Palettes              */
+    byte mirroring;     /* Name table layout (MIRROR_xxx, memory.h) */
+
     /* NMI (VBLANK) */
     byte NMI;
 
+    /* Set when a frame completes (start of VBLANK).
+     * Cleared by whoever is pacing frames. */
+    byte frame_ready;
+
+    /* Frameskip: while set, the frame is emulated in full
+     * but no pixels are produced and nothing is presented */
+    byte skip;
+
     /* Set when DMA in progress */
     byte dodma;
 
@@ -75,9 +127,27 @@ struct ppu_instance {
     word T0;
     byte T1;
 
-    /* Pixel/state Tracking */
-    int scanline;       /* Current scanline          */
-    int linecycle;      /* PPU cycle within scanline */
+    /* CPU (and cartridge) on the other side of the bus */
+    struct cpu_instance* cpux;
+
+    /* PPU address line A12, tracked fetch by fetch only while the
+     * cartridge asks for it (a12_exact).  Each filtered rise is
+     * reported to the mapper's a12 hook. */
+    byte a12_exact;
+    byte a12;
+    unsigned long long a12_fell;    /* clock when A12 last fell */
+
+    /* Cartridge has CHR latches (MMC2/MMC4): fetches of tiles $FD
+     * & $FE are reported to the mapper's latch hook */
+    byte chr_latch;
+
+#if defined (COROUTINES)
+    /* The PPU runs as a coroutine, behind the CPU: owed is how
+     * far (PPU cycles) the CPU has got ahead of it */
+    struct coro_instance* coro;     /* (made by the 1st ppu_sync) */
+    struct coro_instance* host;     /* whatever runs the CPU      */
+    int owed;
+#endif
 };
 
 #if defined __cplusplus
@@ -85,8 +155,21 @@ extern "C" {
 #endif
 
 ppu_inst* make_ppu ();
+void init_ppu (ppu_inst* ppux);
 int run_ppu (ppu_inst* ppux, int dcycles);
 
+/* Drives A12 of the PPU address bus (while a12_exact) */
+void ppu_a12 (ppu_inst* ppux, int level);
+
+#if defined (COROUTINES)
+/* Switches to the PPU until it has caught up with the CPU, and
+ * posts its next vblank (EVENT_PPU) so the CPU cannot pass it */
+void ppu_sync (ppu_inst* ppux);
+
+/* Frees the PPU coroutine (if it was ever made) */
+void destroy_ppu_coro (ppu_inst* ppux);
+#endif
+
 #if defined __cplusplus
 }
 #endif
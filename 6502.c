@@ -30,6 +30,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "6502.h"
 #include "6502_types.h"
 #include "2C02.h"
@@ -892,6 +893,7 @@ cli (cpu_inst* cpux)
 {
     cpux->amode[cpux->OP](cpux);
     UNSET_FLAG (FLAG_IRQE);
+    poll_interrupts_late (cpux);
 }
 
 
@@ -1469,6 +1471,9 @@ plp (cpu_inst* cpux)
 
     // BRK (SWI) flag is never set *IN* status reg
     UNSET_FLAG (FLAG_SWI);
+
+    // (may have cleared I)
+    poll_interrupts_late (cpux);
 }
 
 
@@ -1709,6 +1714,7 @@ rti (cpu_inst* cpux)
 
     // Restore Status Register
     STACK_POP (cpux->S);
+    poll_interrupts (cpux);
 
     // Restore Program Counter
     STACK_POP (cpux->PC);
@@ -2079,6 +2085,123 @@ nmi (cpu_inst* cpux)
 
 }
 
+// Maskable interrupt (taken while the IRQ line is asserted
+// and interrupts are enabled)
+static void
+irq (cpu_inst* cpux)
+{
+    // Save the PC to the Stack MSB first
+    STACK_PUSH ((byte)(cpux->PC >> 8));
+    STACK_PUSH ((byte)(cpux->PC & 0x00FF));
+
+    // Save status register (B clear: not a BRK)
+    STACK_PUSH ((cpux->S & ~BIT4) | BIT5);
+
+    // No further IRQs until the handler allows them
+    SET_FLAG (FLAG_IRQE);
+
+    // Grab jump address from IRQ/BRK vector @ 0xFFFE
+    cpux->PC = MEM_READ (0xFFFE)
+             + (MEM_READ (0xFFFF) << 8);
+}
+
+// The interrupt controller (EVENT_POLL): takes NMI or IRQ if one
+// is due.  An IRQ still waiting (behind an NMI) gets another look
+// after the next instruction; masked IRQs wait for CLI, PLP or
+// RTI to ask again.
+static void
+interrupt (cpu_inst* cpux)
+{
+    ppu_inst* ppux = cpux->ppux;
+
+    if (ppux->NMI) {
+        nmi (cpux);
+        ppux->NMI = 0;
+    } else if (cpux->IRQ && !(cpux->S & FLAG_IRQE)) {
+        irq (cpux);
+    }
+
+    if (cpux->IRQ && !(cpux->S & FLAG_IRQE)) {
+        schedule_event (cpux, EVENT_POLL, PPU_NOW (ppux) + 1);
+    }
+}
+
+/********************************************************************
+ * E V E N T S                                                      *
+ ********************************************************************/
+
+// The queue holds at most one event of each kind, so it is a
+// handful of entries kept sorted: the next one due is always
+// events[0] (mirrored in next_event for run_cpu).
+
+// Where kind sits in the queue (-1 if not pending)
+static int
+find_event (cpu_inst* cpux, int kind)
+{
+    int i;
+
+    for (i=0; i<cpux->nevents; i++) {
+        if (cpux->events[i].kind == kind) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void
+remove_event (cpu_inst* cpux, int i)
+{
+    cpux->nevents--;
+    memmove (&cpux->events[i], &cpux->events[i+1],
+             (cpux->nevents - i) * sizeof(cpu_event));
+
+    cpux->next_event = cpux->nevents ? cpux->events[0].clock : PPU_NEVER;
+}
+
+// Runs every event that is due.  Returns 1 if run_cpu should stop
+// here: a frame finished and may_stop is set (otherwise the frame
+// event is just dropped).
+static int
+run_events (cpu_inst* cpux, int may_stop)
+{
+    ppu_inst* ppux = cpux->ppux;
+    int kind;
+
+#if defined (COROUTINES)
+    // Whatever the PPU posts up to now (NMI, frame, IRQs) must be
+    // in the queue before we look at it
+    ppu_sync (ppux);
+#endif
+
+    while (cpux->next_event <= PPU_NOW (ppux)) {
+        kind = cpux->events[0].kind;
+        remove_event (cpux, 0);
+
+        switch (kind)
+        {
+        case EVENT_FRAME:
+            if (may_stop) {
+                return 1;
+            }
+            break;
+        case EVENT_POLL:
+            interrupt (cpux);
+            break;
+#if defined (COROUTINES)
+        case EVENT_PPU:
+            // (caught up above, which also posted the next one)
+            break;
+#endif
+        default:
+            cpux->IRQ |= (1 << (kind - EVENT_IRQ));
+            schedule_event (cpux, EVENT_POLL, PPU_NOW (ppux));
+            break;
+        }
+    }
+
+    return 0;
+}
+
 /********************************************************************
  * E N G I N E     I N T E R F A C E S                              *
  ********************************************************************/
@@ -2400,6 +2523,17 @@ make_cpu (cpu_luts* luts)
     /* Allocate a CPU instance for a 6502 CPU */
     cpu_inst* cpux = (cpu_inst*) malloc (sizeof(cpu_inst));
 
+    init_cpu (cpux, luts);
+
+    /* Return the address of the allocated register file */
+    return cpux;
+}
+
+
+// Puts a CPU instance (wherever it lives) into its power-on state
+void
+init_cpu (cpu_inst* cpux, cpu_luts* luts)
+{
     /* Populate the registers with power-on values */
     cpux->PC = 0x0000;   // Program Counter
     cpux->SP = 0xFD;     // Stack Pointer
@@ -2417,7 +2551,16 @@ make_cpu (cpu_luts* luts)
     cpux->xtra_cycles = 0;
 
     /* Caller responsible for allocating and setting */
-    cpux->mmap = 0;
+    memset (cpux->mmap, 0, sizeof(cpux->mmap));
+    cpux->mem  = 0;
+    cpux->RAM  = 0;
+    cpux->SRAM = 0;
+    cpux->EXP  = 0;
+    cpux->sram_dirty = 0;
+    memset (cpux->mapper_regs, 0, MAPPER_REGS);
+    cpux->IRQ = 0;
+    cpux->nevents = 0;
+    cpux->next_event = PPU_NEVER;
 
     /* Not a fan of this, but we attach the PPU to
      * the CPU.  This works out well in the code */
@@ -2427,10 +2570,9 @@ make_cpu (cpu_luts* luts)
     cpux->opcode = luts->opcode;
     cpux->amode  = luts->amode;
     cpux->cycles = luts->cycles;
-    cpux->mapper = luts->mapper;
 
-    /* Return the address of the allocated register file */
-    return cpux;
+    /* No cartridge (see attach_rom) */
+    cpux->mapper = 0;
 }
 
 
@@ -2449,18 +2591,122 @@ reset_cpu (cpu_inst* cpux)
     cpux->PC = MEM_READ(0xFFFC) + (MEM_READ(0xFFFD) << 8);
 }
 
-// Runs the 6502 CPU for the specified number of cycles.
+void
+schedule_event (cpu_inst* cpux, int kind, unsigned long long clock)
+{
+    cpu_event* ev = cpux->events;
+    int i = find_event (cpux, kind);
+
+    if (i >= 0) {
+        remove_event (cpux, i);
+    }
+    if (clock == PPU_NEVER) {
+        return;
+    }
+
+    // insertion: shift the later ones up one
+    for (i=cpux->nevents; i>0; i--) {
+        if ((ev[i-1].clock < clock) ||
+            ((ev[i-1].clock == clock) && (ev[i-1].kind < kind))) {
+            break;
+        }
+        ev[i] = ev[i-1];
+    }
+    ev[i].clock = clock;
+    ev[i].kind = kind;
+    cpux->nevents++;
+    cpux->next_event = ev[0].clock;
+}
+
+
+void
+irq_schedule (cpu_inst* cpux, int source, unsigned long long clock)
+{
+    int i = find_event (cpux, EVENT_IRQ + source);
+
+    // an assert that is already due (but not yet seen) stands
+    if ((i >= 0) && (cpux->events[i].clock <= PPU_NOW (cpux->ppux))) {
+        cpux->IRQ |= (1 << source);
+    }
+    schedule_event (cpux, EVENT_IRQ + source, clock);
+}
+
+
+// Due events are at the front of the queue: assert the IRQ ones
+void
+irq_sync (cpu_inst* cpux)
+{
+    unsigned long long now = PPU_NOW (cpux->ppux);
+    int i = 0;
+
+    while ((i < cpux->nevents) && (cpux->events[i].clock <= now)) {
+        if ((cpux->events[i].kind >= EVENT_IRQ) &&
+            (cpux->events[i].kind < EVENT_PPU)) {
+            cpux->IRQ |= (1 << (cpux->events[i].kind - EVENT_IRQ));
+            remove_event (cpux, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+
+void
+irq_release (cpu_inst* cpux, int source)
+{
+    cpux->IRQ &= ~(1 << source);
+    schedule_event (cpux, EVENT_IRQ + source, PPU_NEVER);
+}
+
+
+void
+poll_interrupts (cpu_inst* cpux)
+{
+    schedule_event (cpux, EVENT_POLL, PPU_NOW (cpux->ppux));
+}
+
+
+// (a poll that is already due, e.g. for an NMI, stands)
+void
+poll_interrupts_late (cpu_inst* cpux)
+{
+    unsigned long long next = PPU_NOW (cpux->ppux) + 1;
+    int i = find_event (cpux, EVENT_POLL);
+
+    if ((i < 0) || (cpux->events[i].clock > next)) {
+        schedule_event (cpux, EVENT_POLL, next);
+    }
+}
+
+
+// Runs the 6502 CPU for the specified number of cycles, or until
+// the end of a frame (if at least one instruction ran).  The only
+// check between instructions is whether an event is due.
 int
 run_cpu (cpu_inst* cpux, int cycles)
 {
     int save_cycles = cycles;
     ppu_inst* ppux = cpux->ppux;
 
+#if defined (COROUTINES)
+    // (posts the next vblank, e.g. after a reset or state load)
+    ppu_sync (ppux);
+#endif
+
     while (cycles > 0) {
 
-        if (ppux->NMI) {
-            nmi (cpux);
-            ppux->NMI = 0;
+#if defined (COROUTINES)
+        // With exact A12 the PPU asserts mapper IRQs itself, so it
+        // has to be caught up at every instruction
+        if (ppux->a12_exact) {
+            ppu_sync (ppux);
+        }
+#endif
+
+        if (PPU_NOW (ppux) >= cpux->next_event) {
+            if (run_events (cpux, cycles != save_cycles)) {
+                break;
+            }
         }
 
         // Fetch opcode from MEM & increment Program Counter
@@ -2469,9 +2715,6 @@ run_cpu (cpu_inst* cpux, int cycles)
         // Execute opcode
         cpux->opcode[cpux->OP](cpux);
 
-        // Update Memory Map
-        cpux->mapper[cpux->mapper_id](cpux, 0);
-
         // Update CPU cycle limiter
         cycles -= cpux->cycles[cpux->OP]
                 + cpux->xtra_cycles;
@@ -2483,5 +2726,10 @@ run_cpu (cpu_inst* cpux, int cycles)
         SET_FLAG (FLAG_5);
     }
 
+#if defined (COROUTINES)
+    // (the caller gets a PPU that has caught up)
+    ppu_sync (ppux);
+#endif
+
     return save_cycles - cycles;
 }
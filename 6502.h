@@ -23,6 +23,35 @@
 #include "romreader.h"
 #include "2C02.h"
 
+/* Defined in memory.h */
+typedef struct nes_memory_struct nes_memory;
+typedef struct mapper_descriptor mapper_desc;
+
+/* Bytes of mapper state kept in cpu_inst */
+#define MAPPER_REGS 32
+
+/* IRQ sources: source n drives bit (1 << n) of the IRQ line */
+#define IRQ_MAPPER      0
+#define IRQ_FRAME       1       /* APU frame counter (no APU yet) */
+#define IRQ_DMC         2       /* APU DMC           (no APU yet) */
+#define IRQ_SOURCES     3
+
+/* Event kinds (see schedule_event); each is pending at most once.
+ * Events due at the same clock run in this order. */
+#define EVENT_FRAME     0       /* PPU finished a frame: run_cpu returns */
+#define EVENT_POLL      1       /* look at NMI & the IRQ line            */
+#define EVENT_IRQ       2       /* + source: assert its bit of the line  */
+/* (COROUTINES) the PPU reaches vblank: catch it up */
+#define EVENT_PPU       (EVENT_IRQ + IRQ_SOURCES)
+#define EVENT_KINDS     (EVENT_PPU + 1)
+
+// A scheduled event
+typedef struct cpu_event_struct cpu_event;
+struct cpu_event_struct {
+    unsigned long long clock;   /* PPU clock it is due at */
+    int kind;
+};
+
 // A 6502 CPU instance.
 typedef struct cpu_instance cpu_inst;
 struct cpu_instance {
@@ -47,11 +76,15 @@ struct cpu_instance {
     /* Memory Mapper ID */
     byte mapper_id;
 
-    /* Memory Maps */
-    byte** mmap;
+    /* IRQ line: one bit per source, asserted while any is set */
+    byte IRQ;
 
-    /* Loaded NES ROM */
-    nes_rom* rom0;
+    /* PPU clock of the earliest scheduled event (events[0]).  Until
+     * then run_cpu runs instructions back to back. */
+    unsigned long long next_event;
+
+    // Everything above and the pointers below are touched by
+    // every instruction, and fit in the first cache line.
 
     /* Not a fan of this, but it works out well */
     ppu_inst* ppux;
@@ -60,7 +93,39 @@ struct cpu_instance {
     void (**opcode)(cpu_inst* cpux);
     void (**amode)(cpu_inst* cpux);
     int *cycles;
-    void (**mapper)(cpu_inst* cpux, int init);
+
+    /* Memory Mapper (from the registry, see memory.h) */
+    const mapper_desc* mapper;
+
+    /* Memory Map (1KB pages) */
+    byte* mmap[CPU_PAGES];
+
+    /* Memory Mapper registers & bank selections
+     * (layout is up to each mapper) */
+    byte mapper_regs[MAPPER_REGS];
+
+    /* Event queue, sorted by clock (then kind) */
+    cpu_event events[EVENT_KINDS];
+    int nevents;
+
+    /* Set on every SRAM write (cleared by the SRAM flusher thread,
+     * so only touched with __atomic builtins) */
+    byte sram_dirty;
+
+    /* PRG-RAM chip enable: $6000-$7FFF writes are dropped while
+     * clear (the pages then show open bus) */
+    byte sram_enabled;
+
+    /* All mutable memory of this instance, in one block */
+    nes_memory* mem;
+
+    /* Memory behind the map (see init_nes_memorymap) */
+    byte* RAM;          /* 2KB internal RAM          */
+    byte* SRAM;         /* 8KB Save RAM              */
+    byte* EXP;          /* 8KB I/O & Expansion area  */
+
+    /* Loaded NES ROM */
+    nes_rom* rom0;
 };
 
 // Populated when the 6502 engine is initialized.
@@ -76,8 +141,6 @@ struct cpu_look_up_tables {
 
     /* Clock cycle LUT */
     int *cycles;
-
-    void (**mapper)(cpu_inst* cpux, int init);
 };
 
 
@@ -95,6 +158,9 @@ void unload_6502_engine (cpu_luts** luts);
 /* Spawns a virtual 6502 CPU */
 cpu_inst* make_cpu (cpu_luts* luts);
 
+/* Power-on state for an already allocated CPU */
+void init_cpu (cpu_inst* cpux, cpu_luts* luts);
+
 /* Destroy's a virtual 6502 CPU */
 void destroy_cpu (cpu_inst** cpux);
 
@@ -104,6 +170,29 @@ void reset_cpu (cpu_inst* cpux);
 /* Runs a virtual 6502 CPU for a defined # of cycles */
 int run_cpu (cpu_inst* cpux, int cycles);
 
+/* Event scheduler.  The PPU clock is the master clock (64-bit,
+ * 3 per CPU cycle); schedules an event of kind for clock, replacing
+ * any pending one of that kind (PPU_NEVER just cancels). */
+void schedule_event (cpu_inst* cpux, int kind, unsigned long long clock);
+
+/* IRQ sources report when they will next assert the line (a PPU
+ * clock: now or earlier asserts at the next instruction, PPU_NEVER
+ * cancels).  The line stays asserted until the source releases. */
+void irq_schedule (cpu_inst* cpux, int source, unsigned long long clock);
+void irq_release (cpu_inst* cpux, int source);
+
+/* Asserts the line for sources whose time has come (save states
+ * call this so the line is stored as of the save) */
+void irq_sync (cpu_inst* cpux);
+
+/* NMI was raised, or RTI cleared the I flag: look at the inputs
+ * before the next instruction */
+void poll_interrupts (cpu_inst* cpux);
+
+/* CLI or PLP cleared the I flag: the 6502 polled before the flag
+ * changed, so look only after the next instruction */
+void poll_interrupts_late (cpu_inst* cpux);
+
 #if defined __cplusplus
 }
 #endif
@@ -43,4 +43,15 @@ typedef unsigned short word;
 #define FLAG_ZERO   BIT1    /* Zero Flag            */
 #define FLAG_CARRY  BIT0    /* Carry Flag           */
 
+/* Memory maps are tables of 1KB pages */
+#define MMAP_PAGE_SHIFT 10
+#define MMAP_PAGE_SIZE  (1 << MMAP_PAGE_SHIFT)
+#define MMAP_PAGE_MASK  (MMAP_PAGE_SIZE - 1)
+#define CPU_PAGES       64      /* $0000-$FFFF                    */
+#define PPU_PAGES       16      /* $0000-$3FFF (mirrored to $FFFF) */
+
+/* The byte at address in a page table */
+#define MMAP_BYTE(mmap, addr) \
+    ((mmap)[((addr) >> MMAP_PAGE_SHIFT)][(addr) & MMAP_PAGE_MASK])
+
 #endif
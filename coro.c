@@ -0,0 +1,130 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "coro.h"
+
+#if !defined (__x86_64__) || defined (_WIN32)
+#error "COROUTINES builds need x86-64 (System V ABI)"
+#endif
+
+// coro_swap (&from->sp, to->sp)
+//   Pushes the callee-saved registers, parks the stack pointer in
+//   *save, picks up the other stack & pops its registers.  The ret
+//   then lands wherever that stack last called coro_swap from.
+//
+// coro_boot
+//   Where a new coroutine's first switch lands: its stack was made
+//   to look as if coro_swap had been called with rbx = the coro_inst
+//   and r12 = coro_start.
+void coro_swap (void **save, void *load) __asm__ ("retrobox_coro_swap");
+void coro_boot () __asm__ ("retrobox_coro_boot");
+
+__asm__ (
+    ".text\n"
+    ".p2align 4\n"
+    ".globl retrobox_coro_swap\n"
+    "retrobox_coro_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq  %rsp, (%rdi)\n"
+    "    movq  %rsi, %rsp\n"
+    "    popq  %r15\n"
+    "    popq  %r14\n"
+    "    popq  %r13\n"
+    "    popq  %r12\n"
+    "    popq  %rbx\n"
+    "    popq  %rbp\n"
+    "    ret\n"
+    ".p2align 4\n"
+    ".globl retrobox_coro_boot\n"
+    "retrobox_coro_boot:\n"
+    "    movq  %rbx, %rdi\n"
+    "    jmp   *%r12\n"
+);
+
+
+static void
+coro_start (coro_inst* corox)
+{
+    corox->entry (corox->arg);
+
+    // (there is nothing to return to)
+    printf ("coro: coroutine entry returned\n");
+    exit (0);
+}
+
+
+coro_inst*
+make_coro (void (*entry)(void *arg), void *arg, size_t stack_size)
+{
+    coro_inst *corox;
+    void **sp;
+
+    corox = (coro_inst*) malloc (sizeof(coro_inst));
+    corox->sp = 0;
+    corox->stack = 0;
+    corox->entry = entry;
+    corox->arg = arg;
+
+    if (!entry) {
+        return corox;
+    }
+
+    corox->stack = malloc (stack_size);
+    if (!corox->stack) {
+        printf ("coro: unable to allocate a %u byte stack\n",
+                (unsigned int) stack_size);
+        exit (0);
+    }
+
+    // The frame coro_swap pops on the first switch.  The stack is
+    // 16 byte aligned + 8 at coro_start, as after a call.
+    sp = (void**) (((uintptr_t) corox->stack + stack_size) & ~(uintptr_t) 15);
+    *--sp = 0;                          // (coro_start's return address)
+    *--sp = (void*) coro_boot;          // ret
+    *--sp = 0;                          // rbp
+    *--sp = (void*) corox;              // rbx
+    *--sp = (void*) coro_start;         // r12
+    *--sp = 0;                          // r13
+    *--sp = 0;                          // r14
+    *--sp = 0;                          // r15
+    corox->sp = sp;
+
+    return corox;
+}
+
+
+void
+coro_switch (coro_inst* from, coro_inst* to)
+{
+    coro_swap (&from->sp, to->sp);
+}
+
+
+void
+destroy_coro (coro_inst* corox)
+{
+    free (corox->stack);
+    free (corox);
+}
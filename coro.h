@@ -0,0 +1,59 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _coro_h_
+#define _coro_h_
+
+#include <stddef.h>
+
+// Cooperative, stackful coroutines (COROUTINES builds only).
+// A switch saves just the registers the x86-64 System V ABI has
+// a callee preserve, by hand: no signal masks or system calls as
+// with ucontext, so it costs about as much as a function call.
+
+typedef struct coro_instance coro_inst;
+struct coro_instance {
+
+    void *sp;                   // stack pointer while switched out
+    void *stack;                // own stack (0: a thread's own)
+
+    void (*entry)(void *arg);   // runs forever once switched to
+    void *arg;
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+    /* A coroutine that starts in entry (arg) on a stack of its own.
+     * With no entry, stands for whatever thread switches away from
+     * it, so it can be switched back to. */
+    coro_inst* make_coro (void (*entry)(void *arg), void *arg,
+                          size_t stack_size);
+
+    /* Suspends from (the running coroutine) & resumes to */
+    void coro_switch (coro_inst* from, coro_inst* to);
+
+    /* Frees a coroutine that is not running */
+    void destroy_coro (coro_inst* corox);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
@@ -19,8 +19,11 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <unistd.h>
 #include <SDL.h>
 #include "display.h"
+#include "ntsc.h"
+#include "hash.h"
 
 static void
 set_pixel_rgb (SDL_Surface *surface, int idx, Uint8 r, Uint8 g, Uint8 b)
@@ -44,16 +47,13 @@ set_pixel_hv (disp_inst* displayx, int idx)
     Uint32 color;
     unsigned int hv;
 
-    hv = displayx->pixels[idx];
+    // Pixels are 9-bit (emphasis:hue:value).  The flat
+    // RGB palette ignores the color emphasis bits.
+    hv = displayx->pixels[idx] & 0x3F;
 
-    if (hv < 0x40) {
-        r = (displayx->palette[hv] & 0xFF0000) >> 16;
-        g = (displayx->palette[hv] & 0x00FF00) >> 8;
-        b = (displayx->palette[hv] & 0x0000FF) >> 0;
-    } else {
-        printf ("display.c: Pixel value outside of palette range!\n");
-//        r = 0xDB; g = 0x2B; b = 0;
-    }
+    r = (displayx->palette[hv] & 0xFF0000) >> 16;
+    g = (displayx->palette[hv] & 0x00FF00) >> 8;
+    b = (displayx->palette[hv] & 0x0000FF) >> 0;
 
 
     // Cast SDL surface pixels and add address offset
@@ -84,6 +84,7 @@ make_display (int width, int height, int depth, int fullscreen, int interp)
 {
     disp_inst *displayx;
     SDL_Surface *surface;
+    int i;
 
     // Finally, set the window caption
     SDL_WM_SetCaption("retro.box", "retrobox");
@@ -109,6 +110,22 @@ make_display (int width, int height, int depth, int fullscreen, int interp)
     displayx->depth      = depth;
     displayx->fullscreen = fullscreen;
     displayx->interp     = interp;
+    displayx->vdump      = 0;
+    displayx->ntsc       = 0;
+
+    // NTSC composite filter: one band of scanlines per core
+    if (interp == 3) {
+        i = sysconf (_SC_NPROCESSORS_ONLN);
+        displayx->ntsc = make_ntsc (surface->format->Rshift,
+                                    surface->format->Gshift,
+                                    surface->format->Bshift,
+                                    (i < 1) ? 1 : (i > 4) ? 4 : i);
+    }
+
+    displayx->frame       = 0;
+    displayx->hash_frames = 0;
+    displayx->frame_hash  = 0;
+    displayx->hash_log    = 0;
 
     // Finally, build the NES system palette
     displayx->palette = (unsigned int*) malloc (64 * sizeof(unsigned int));
@@ -158,6 +175,23 @@ update_display (disp_inst* displayx)
     Uint8 h, v;
     int i;
 
+    // Fingerprint the finished frame (for determinism checks)
+    if (displayx->hash_frames) {
+        displayx->frame_hash = xxh64 (displayx->pixels,
+                                      256*240*sizeof(unsigned int), 0);
+        if (displayx->hash_log) {
+            fprintf (displayx->hash_log, "%u %016llx\n", displayx->frame,
+                     (unsigned long long) displayx->frame_hash);
+        }
+    }
+    displayx->frame++;
+
+    // Hand the finished frame to the recorder next.  This is
+    // just a copy into its queue; the writer thread does the rest.
+    if (displayx->vdump) {
+        vdump_frame (displayx->vdump, displayx->pixels);
+    }
+
     // Lock the SDL surface so we can manipulate its pixel data
     if (SDL_MUSTLOCK(surface)) {
         if (SDL_LockSurface(surface) < 0) {
@@ -185,6 +219,14 @@ update_display (disp_inst* displayx)
         // Cubic B-spline, perahps?  just for fun...
         case 2:
             break;
+
+        // NTSC composite signal (602 pixels wide, surface
+        // must be 32-bit and 240 or 480 lines tall)
+        case 3:
+            ntsc_blit (displayx->ntsc, displayx->pixels,
+                       (uint32_t*) surface->pixels, surface->pitch / 4,
+                       surface->h / 240, displayx->frame);
+            break;
     }
 
 
@@ -200,6 +242,9 @@ update_display (disp_inst* displayx)
 void
 destroy_display (disp_inst* displayx)
 {
+    if (displayx->ntsc) {
+        destroy_ntsc (displayx->ntsc);
+    }
     free (displayx->palette);
     free (displayx->pixels);
     SDL_FreeSurface (displayx->surface);
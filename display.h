@@ -18,7 +18,11 @@
 #ifndef _display_h_
 #define _display_h_
 
+#include <stdio.h>
+#include <stdint.h>
 #include <SDL.h>
+#include "vdump.h"
+#include "ntsc.h"
 
 typedef struct disp_instance disp_inst;
 struct disp_instance {
@@ -28,7 +32,7 @@ struct disp_instance {
     int height;         // y-resolution
     int depth;          // bit depth
     int fullscreen;     // 0 = windowed, 1 = fullscreen
-    int interp;         // 0 = nearest neighbor, 1 = ???, 2 = ???
+    int interp;         // 0 = nearest neighbor, 1 = ???, 2 = ???, 3 = NTSC
 
     /* our SDL surface */
     SDL_Surface *surface;
@@ -43,6 +47,18 @@ struct disp_instance {
     /* HSV to RGB Palette LUT */
     unsigned int *palette;
 
+    /* NTSC composite filter (interp mode 3 only) */
+    ntsc_inst *ntsc;
+
+    /* Optional video dump (0 = not recording) */
+    vdump_inst *vdump;
+
+    /* Frame bookkeeping */
+    unsigned int frame;     // # of frames completed so far
+    int hash_frames;        // 1 = hash each completed frame
+    uint64_t frame_hash;    // xxh64 of pixels[] for the last frame
+    FILE *hash_log;         // per-frame hash log (0 = none)
+
 };
 
 
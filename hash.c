@@ -0,0 +1,324 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "hash.h"
+
+/********************************************************************
+ * X X H 6 4                                                        *
+ *                                                                  *
+ *   Yann Collet's xxHash, 64-bit variant.  Four independent        *
+ *   accumulator lanes per 32-byte stripe, which compilers happily  *
+ *   keep in registers (or vector registers).                       *
+ ********************************************************************/
+
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x,r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+// Unaligned little-endian loads
+static inline uint64_t
+read64 (const unsigned char *p)
+{
+    uint64_t v;
+    memcpy (&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+read32 (const unsigned char *p)
+{
+    uint32_t v;
+    memcpy (&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+xxh64_round (uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME2;
+    acc  = ROTL64 (acc, 31);
+    acc *= XXH_PRIME1;
+    return acc;
+}
+
+static inline uint64_t
+xxh64_merge (uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round (0, val);
+    acc  = acc * XXH_PRIME1 + XXH_PRIME4;
+    return acc;
+}
+
+uint64_t
+xxh64 (const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *p   = (const unsigned char*) data;
+    const unsigned char *end = p + len;
+    uint64_t h, v1, v2, v3, v4;
+
+    if (len >= 32) {
+        const unsigned char *limit = end - 32;
+
+        v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        v2 = seed + XXH_PRIME2;
+        v3 = seed;
+        v4 = seed - XXH_PRIME1;
+
+        do {
+            v1 = xxh64_round (v1, read64 (p +  0));
+            v2 = xxh64_round (v2, read64 (p +  8));
+            v3 = xxh64_round (v3, read64 (p + 16));
+            v4 = xxh64_round (v4, read64 (p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = ROTL64 (v1, 1) + ROTL64 (v2, 7) + ROTL64 (v3, 12) + ROTL64 (v4, 18);
+        h = xxh64_merge (h, v1);
+        h = xxh64_merge (h, v2);
+        h = xxh64_merge (h, v3);
+        h = xxh64_merge (h, v4);
+    } else {
+        h = seed + XXH_PRIME5;
+    }
+
+    h += (uint64_t) len;
+
+    // Tail: 8, then 4, then 1 byte at a time
+    while (p + 8 <= end) {
+        h ^= xxh64_round (0, read64 (p));
+        h  = ROTL64 (h, 27) * XXH_PRIME1 + XXH_PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t) read32 (p) * XXH_PRIME1;
+        h  = ROTL64 (h, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_PRIME5;
+        h  = ROTL64 (h, 11) * XXH_PRIME1;
+        p++;
+    }
+
+    // Avalanche
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+
+/********************************************************************
+ * C R C 3 2                                                        *
+ *                                                                  *
+ *   Slicing-by-8: eight table lookups retire 8 input bytes per     *
+ *   iteration with no loop-carried dependency between them.        *
+ ********************************************************************/
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void
+crc32_init ()
+{
+    uint32_t c;
+    int i, j;
+
+    for (i=0; i<256; i++) {
+        c = i;
+        for (j=0; j<8; j++) {
+            c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+        }
+        crc_table[0][i] = c;
+    }
+    for (i=0; i<256; i++) {
+        c = crc_table[0][i];
+        for (j=1; j<8; j++) {
+            c = crc_table[0][c & 0xFF] ^ (c >> 8);
+            crc_table[j][i] = c;
+        }
+    }
+}
+
+uint32_t
+crc32_update (uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char*) data;
+    uint32_t lo, hi;
+
+    pthread_once (&crc_once, crc32_init);
+
+    crc = ~crc;
+
+    while (len >= 8) {
+        lo = read32 (p) ^ crc;
+        hi = read32 (p + 4);
+        crc = crc_table[7][(lo      ) & 0xFF] ^
+              crc_table[6][(lo >>  8) & 0xFF] ^
+              crc_table[5][(lo >> 16) & 0xFF] ^
+              crc_table[4][(lo >> 24)       ] ^
+              crc_table[3][(hi      ) & 0xFF] ^
+              crc_table[2][(hi >>  8) & 0xFF] ^
+              crc_table[1][(hi >> 16) & 0xFF] ^
+              crc_table[0][(hi >> 24)       ];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+
+/********************************************************************
+ * S H A - 1                                                        *
+ ********************************************************************/
+
+#define ROTL32(x,r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+static void
+sha1_block (sha1_ctx *ctx, const unsigned char *blk)
+{
+    uint32_t w[80];
+    uint32_t a, b, c, d, e, f, k, t;
+    int i;
+
+    for (i=0; i<16; i++) {
+        w[i] = ((uint32_t) blk[4*i + 0] << 24) |
+               ((uint32_t) blk[4*i + 1] << 16) |
+               ((uint32_t) blk[4*i + 2] <<  8) |
+               ((uint32_t) blk[4*i + 3] <<  0);
+    }
+    for (i=16; i<80; i++) {
+        w[i] = ROTL32 (w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    a = ctx->h[0];
+    b = ctx->h[1];
+    c = ctx->h[2];
+    d = ctx->h[3];
+    e = ctx->h[4];
+
+    for (i=0; i<80; i++) {
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        t = ROTL32 (a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROTL32 (b, 30);
+        b = a;
+        a = t;
+    }
+
+    ctx->h[0] += a;
+    ctx->h[1] += b;
+    ctx->h[2] += c;
+    ctx->h[3] += d;
+    ctx->h[4] += e;
+}
+
+void
+sha1_init (sha1_ctx *ctx)
+{
+    ctx->h[0] = 0x67452301;
+    ctx->h[1] = 0xEFCDAB89;
+    ctx->h[2] = 0x98BADCFE;
+    ctx->h[3] = 0x10325476;
+    ctx->h[4] = 0xC3D2E1F0;
+    ctx->len  = 0;
+}
+
+void
+sha1_update (sha1_ctx *ctx, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char*) data;
+    size_t fill = ctx->len % 64;
+    size_t n;
+
+    ctx->len += len;
+
+    // Top up a partial block first
+    if (fill) {
+        n = 64 - fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy (ctx->block + fill, p, n);
+        p += n;
+        len -= n;
+        if (fill + n < 64) {
+            return;
+        }
+        sha1_block (ctx, ctx->block);
+    }
+
+    // Whole blocks straight from the input
+    while (len >= 64) {
+        sha1_block (ctx, p);
+        p += 64;
+        len -= 64;
+    }
+
+    memcpy (ctx->block, p, len);
+}
+
+void
+sha1_final (sha1_ctx *ctx, unsigned char digest[20])
+{
+    uint64_t bits = ctx->len * 8;
+    size_t fill = ctx->len % 64;
+    int i;
+
+    ctx->block[fill++] = 0x80;
+    if (fill > 56) {
+        memset (ctx->block + fill, 0, 64 - fill);
+        sha1_block (ctx, ctx->block);
+        fill = 0;
+    }
+    memset (ctx->block + fill, 0, 56 - fill);
+    for (i=0; i<8; i++) {
+        ctx->block[56 + i] = (unsigned char) (bits >> (56 - 8*i));
+    }
+    sha1_block (ctx, ctx->block);
+
+    for (i=0; i<20; i++) {
+        digest[i] = (unsigned char) (ctx->h[i/4] >> (24 - 8*(i%4)));
+    }
+}
@@ -0,0 +1,52 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _hash_h_
+#define _hash_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Streaming SHA-1 state */
+typedef struct sha1_context sha1_ctx;
+struct sha1_context {
+    uint32_t h[5];
+    uint64_t len;               // bytes hashed so far
+    unsigned char block[64];    // partial block
+};
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* 64-bit xxHash (XXH64) of a buffer */
+uint64_t xxh64 (const void *data, size_t len, uint64_t seed);
+
+/* CRC-32 (IEEE 802.3).  Start with crc = 0 and feed
+ * the running value back in to hash a stream. */
+uint32_t crc32_update (uint32_t crc, const void *data, size_t len);
+
+/* SHA-1 */
+void sha1_init (sha1_ctx *ctx);
+void sha1_update (sha1_ctx *ctx, const void *data, size_t len);
+void sha1_final (sha1_ctx *ctx, unsigned char digest[20]);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include "6502_types.h"
 #include "6502.h"
 #include "2C02.h"
@@ -26,24 +27,43 @@
 #include "romreader.h"
 
 
+#if defined (COROUTINES)
+// The CPU ran n more PPU cycles' worth.  The PPU catches up only
+// once the CPU is a sync window ahead, or at a shared resource.
+// (a macro: read_mem & write_mem are extern inline)
+#define PPU_STEP(ppux, n)                                               \
+    do {                                                                \
+        (ppux)->owed += (n);                                            \
+        if ((ppux)->owed > PPU_SYNC_WINDOW) {                           \
+            ppu_sync (ppux);                                            \
+        }                                                               \
+    } while (0)
+#define PPU_SYNC(ppux)      ppu_sync (ppux)
+#else
+#define PPU_STEP(ppux, n)   run_ppu (ppux, n)
+#define PPU_SYNC(ppux)
+#endif
+
+
 inline void
 do_dma (cpu_inst* cpux)
 {
     int i;
     ppu_inst* ppux = cpux->ppux;
-    byte cpu_base = *cpux->mmap[0x4014] << 8;
+    byte cpu_base = MMAP_BYTE (cpux->mmap, 0x4014) << 8;
 
     // 2 cycles per byte xfer
     // 1 read & 1 write
     for (i=0; i<256; i++) {
-        ppux->OAM[(ppux->OAMADDR + i) & 0xFF] = *cpux->mmap[cpu_base | i];
-        run_ppu (ppux, 2);
+        ppux->OAM[(ppux->OAMADDR + i) & 0xFF] = MMAP_BYTE (cpux->mmap, cpu_base | i);
+        PPU_STEP (ppux, 2);
     }
-    run_ppu (ppux, 1);
+    PPU_STEP (ppux, 1);
 }
 
 // Swaps variable sized pages into the memory map.
-// Perhaps better as a macro?
+// Addresses & sizes are in bytes, but must be whole
+// 1KB map pages: only one pointer per page is set.
 inline void
 swap_in (
         byte **dest,
@@ -55,14 +75,13 @@ swap_in (
 {
     unsigned int i;
 
-    for (i=0; i < page_size; i++) {
-        dest[base_addr_dest + i] = &src[base_addr_src + i];
-//        printf ("%.4X: %.2X  -->  %.2X\n", base_addr_dest + i, *dest[base_addr_dest + i], src[base_addr_src + i]);
+    for (i=0; i < page_size; i += MMAP_PAGE_SIZE) {
+        dest[(base_addr_dest + i) >> MMAP_PAGE_SHIFT] = &src[base_addr_src + i];
     }
 }
 
-// Swaps variable sized pages into the memory map.
-// Perhaps better as a macro?
+// Mirrors one range of the memory map onto another
+// (same 1KB page granularity as swap_in)
 inline void
 mirror (
         byte **mmap,
@@ -73,16 +92,151 @@ mirror (
 {
     unsigned int i;
 
-    for (i=0; i < page_size; i++) {
-        mmap[base_addr_dest + i] = mmap[base_addr_src + i];
+    for (i=0; i < page_size; i += MMAP_PAGE_SIZE) {
+        mmap[(base_addr_dest + i) >> MMAP_PAGE_SHIFT] =
+            mmap[(base_addr_src + i) >> MMAP_PAGE_SHIFT];
+    }
+}
+
+// PPU bus access ($0000-$3FFF, mirrored above).  Palettes live
+// outside the page table since they are mirrored every 32 bytes.
+static byte*
+ppu_byte (ppu_inst* ppux, word address)
+{
+    address &= 0x3FFF;
+
+    if (address >= 0x3F00) {
+        return &ppux->PALETTES[address & 0x1F];
+    } else if (address >= 0x3000) {
+        address -= 0x1000;
     }
+    return &MMAP_BYTE (ppux->mmap, address);
+}
+
+// Which 1KB block of TABLES backs each name table, per mode.
+// Blocks 0 & 1 are the console's 2KB of VRAM (CIRAM A & B), so
+// boards that change mirroring at run time see the same data;
+// blocks 2 & 3 are the extra VRAM of 4-screen boards.
+static const byte nt_blocks[5][4] = {
+    { 0, 0, 1, 1 },         /* MIRROR_HORIZONTAL  */
+    { 0, 1, 0, 1 },         /* MIRROR_VERTICAL    */
+    { 0, 1, 2, 3 },         /* MIRROR_FOUR_SCREEN */
+    { 0, 0, 0, 0 },         /* MIRROR_SINGLE_A    */
+    { 1, 1, 1, 1 },         /* MIRROR_SINGLE_B    */
+};
+
+// Each name table is exactly one map page, so switching mirroring
+// is 4 pointer writes (the $3000 mirror is folded by ppu_byte)
+void
+set_mirroring (ppu_inst* ppux, int mode)
+{
+    byte** nt = &ppux->mmap[0x2000 >> MMAP_PAGE_SHIFT];
+
+    if ((mode < MIRROR_HORIZONTAL) || (mode > MIRROR_SINGLE_B)) {
+        printf ("retrobox: invalid name table mirroring mode (%i)\n", mode);
+        exit (0);
+    }
+
+    nt[0] = ppux->TABLES + 1024*nt_blocks[mode][0];
+    nt[1] = ppux->TABLES + 1024*nt_blocks[mode][1];
+    nt[2] = ppux->TABLES + 1024*nt_blocks[mode][2];
+    nt[3] = ppux->TABLES + 1024*nt_blocks[mode][3];
+    ppux->mirroring = mode;
 }
 
 /********************************************************************
  * M A P P E R S                                                    *
  ********************************************************************/
+
+// Bank switching helpers.  A switch only rewrites the 1KB page
+// pointers covering the bank (16 for 16KB of PRG, 8 for 8KB of
+// CHR), so it costs the same no matter how often games do it.
+// Bank numbers wrap at the ROM size, as on the real boards.
+
+// Maps 16KB PRG-ROM bank # bank at address
+static void
+map_prg16 (cpu_inst* cpux, word address, int bank)
+{
+    nes_rom* romx = cpux->rom0;
+
+    bank %= romx->prg_rom_size;
+    swap_in (cpux->mmap, address, romx->prg_rom, bank * 16384, 16384);
+}
+
+// Maps 32KB PRG-ROM bank # bank at $8000
+static void
+map_prg32 (cpu_inst* cpux, int bank)
+{
+    map_prg16 (cpux, 0x8000, 2*bank);
+    map_prg16 (cpux, 0xC000, 2*bank + 1);
+}
+
+// Maps 8KB PRG-ROM bank # bank at address
 static void
-mapper0 (cpu_inst* cpux, int init)
+map_prg8 (cpu_inst* cpux, word address, int bank)
+{
+    nes_rom* romx = cpux->rom0;
+
+    bank %= 2*romx->prg_rom_size;
+    swap_in (cpux->mmap, address, romx->prg_rom, bank * 8192, 8192);
+}
+
+// Maps 1KB CHR-ROM bank # bank at PPU address (or 1KB of CHR-RAM)
+static void
+map_chr1 (cpu_inst* cpux, word address, int bank)
+{
+    nes_rom* romx = cpux->rom0;
+    ppu_inst* ppux = cpux->ppux;
+
+    if (romx->chr_rom_size) {
+        bank %= 8*romx->chr_rom_size;
+        swap_in (ppux->mmap, address, romx->chr_rom, bank * 1024, 1024);
+    } else {
+        swap_in (ppux->mmap, address, cpux->mem->CHR_RAM, (bank & 7) * 1024, 1024);
+    }
+}
+
+// Maps 4KB CHR-ROM bank # bank at PPU address (or one half of
+// the 8KB of CHR-RAM)
+static void
+map_chr4 (cpu_inst* cpux, word address, int bank)
+{
+    nes_rom* romx = cpux->rom0;
+    ppu_inst* ppux = cpux->ppux;
+
+    if (romx->chr_rom_size) {
+        bank %= 2*romx->chr_rom_size;
+        swap_in (ppux->mmap, address, romx->chr_rom, bank * 4096, 4096);
+    } else {
+        swap_in (ppux->mmap, address, cpux->mem->CHR_RAM, (bank & 1) * 4096, 4096);
+    }
+}
+
+// Maps 8KB CHR-ROM bank # bank at PPU $0000 (boards without
+// CHR-ROM get this instance's 8KB of CHR-RAM instead)
+static void
+map_chr8 (cpu_inst* cpux, int bank)
+{
+    nes_rom* romx = cpux->rom0;
+    ppu_inst* ppux = cpux->ppux;
+
+    if (romx->chr_rom_size) {
+        bank %= romx->chr_rom_size;
+        swap_in (ppux->mmap, 0x0000, romx->chr_rom, bank * 8192, 8192);
+    } else {
+        swap_in (ppux->mmap, 0x0000, cpux->mem->CHR_RAM, 0x0000, 8192);
+    }
+}
+
+// Name table mirroring hard wired on the board (iNES header)
+static void
+map_header_mirroring (cpu_inst* cpux)
+{
+    set_mirroring (cpux->ppux, cpux->rom0->flg_mirroring);
+}
+
+static void
+mapper0_init (cpu_inst* cpux)
 {
     // Mapper 0 is easy.
     //
@@ -104,48 +258,746 @@ mapper0 (cpu_inst* cpux, int init)
     nes_rom* romx = cpux->rom0;
     ppu_inst* ppux = cpux->ppux;
 
-    if (init) {
-        // Map PRG-ROM Pages
-        if (romx->prg_rom_size == 1) {
-            swap_in (cpux->mmap, 0x8000, romx->prg_rom, 0x0000, 16384);
-            swap_in (cpux->mmap, 0xC000, romx->prg_rom, 0x0000, 16384);
-        } else {
-            swap_in (cpux->mmap, 0x8000, romx->prg_rom, 0x0000, 32768);
-        }
+    // Map PRG-ROM Pages
+    if (romx->prg_rom_size == 1) {
+        swap_in (cpux->mmap, 0x8000, romx->prg_rom, 0x0000, 16384);
+        swap_in (cpux->mmap, 0xC000, romx->prg_rom, 0x0000, 16384);
+    } else {
+        swap_in (cpux->mmap, 0x8000, romx->prg_rom, 0x0000, 32768);
+    }
 
-        // Map CHR-ROM Pages
+    // Map CHR-ROM Pages (or this instance's CHR-RAM)
+    if (romx->chr_rom_size) {
         swap_in (ppux->mmap, 0x0000, romx->chr_rom, 0x0000, 4096);
         swap_in (ppux->mmap, 0x1000, romx->chr_rom, 0x0000, 4096);
+    } else {
+        swap_in (ppux->mmap, 0x0000, cpux->mem->CHR_RAM, 0x0000, 4096);
+        swap_in (ppux->mmap, 0x1000, cpux->mem->CHR_RAM, 0x0000, 4096);
+    }
+
+    // Setup Name Table Mirroring
+    map_header_mirroring (cpux);
+}
+
+// Mapper 1 (MMC1): registers are loaded 1 bit at a time through
+// a 5-bit shift register.  Any write to $8000-$FFFF with bit 7 set
+// resets it; otherwise bit 0 is shifted in, and the 5th write
+// lands in the register picked by address bits 14-13:
+//   $8000 control : mirroring (1-0), PRG mode (3-2), CHR mode (4)
+//   $A000 CHR bank 0
+//   $C000 CHR bank 1
+//   $E000 PRG bank (3-0), PRG-RAM disable (4)
+#define MMC1_SHIFT      0       /* mapper_regs layout */
+#define MMC1_COUNT      1
+#define MMC1_CONTROL    2
+#define MMC1_CHR0       3
+#define MMC1_CHR1       4
+#define MMC1_PRG        5
+
+static void
+mmc1_mirroring (cpu_inst* cpux)
+{
+    switch (cpux->mapper_regs[MMC1_CONTROL] & 0x03)
+    {
+    case 0:
+        set_mirroring (cpux->ppux, MIRROR_SINGLE_A);
+        break;
+    case 1:
+        set_mirroring (cpux->ppux, MIRROR_SINGLE_B);
+        break;
+    case 2:
+        set_mirroring (cpux->ppux, MIRROR_VERTICAL);
+        break;
+    case 3:
+        set_mirroring (cpux->ppux, MIRROR_HORIZONTAL);
+        break;
+    }
+}
+
+static void
+mmc1_chr (cpu_inst* cpux)
+{
+    byte* regs = cpux->mapper_regs;
+
+    if (regs[MMC1_CONTROL] & 0x10) {
+        // two independent 4KB banks
+        map_chr4 (cpux, 0x0000, regs[MMC1_CHR0]);
+        map_chr4 (cpux, 0x1000, regs[MMC1_CHR1]);
+    } else {
+        // one 8KB bank (low bit ignored)
+        map_chr4 (cpux, 0x0000, regs[MMC1_CHR0] & ~1);
+        map_chr4 (cpux, 0x1000, regs[MMC1_CHR0] |  1);
+    }
+}
+
+static void
+mmc1_prg (cpu_inst* cpux)
+{
+    byte* regs = cpux->mapper_regs;
+    nes_rom* romx = cpux->rom0;
+    int bank = regs[MMC1_PRG] & 0x0F;
+    int outer = 0;
+
+    // 512KB boards (SUROM) use CHR bank 0 bit 4 to pick
+    // which 256KB half of PRG-ROM the banking applies to
+    if (romx->prg_rom_size > 16) {
+        outer = regs[MMC1_CHR0] & 0x10;
+    }
+
+    switch ((regs[MMC1_CONTROL] >> 2) & 0x03)
+    {
+    case 0:
+    case 1:     // 32KB at $8000 (low bit ignored)
+        map_prg16 (cpux, 0x8000, outer | (bank & ~1));
+        map_prg16 (cpux, 0xC000, outer | (bank |  1));
+        break;
+    case 2:     // first bank fixed at $8000, switch $C000
+        map_prg16 (cpux, 0x8000, outer);
+        map_prg16 (cpux, 0xC000, outer | bank);
+        break;
+    case 3:     // switch $8000, last bank fixed at $C000
+        map_prg16 (cpux, 0x8000, outer | bank);
+        map_prg16 (cpux, 0xC000, outer | 0x0F);
+        break;
+    }
+
+    // PRG-RAM chip enable (active low)
+    if (regs[MMC1_PRG] & 0x10) {
+        swap_in (cpux->mmap, 0x6000, cpux->mem->OPENBUS, 0x0000, MMAP_PAGE_SIZE);
+        mirror (cpux->mmap, 0x6400, 0x6000, 7*MMAP_PAGE_SIZE);
+        cpux->sram_enabled = 0;
+    } else {
+        swap_in (cpux->mmap, 0x6000, cpux->SRAM, 0x0000, 8192);
+        cpux->sram_enabled = 1;
+    }
+}
+
+static void
+mapper1_write (cpu_inst* cpux, word address, byte data)
+{
+    byte* regs = cpux->mapper_regs;
+
+    if (data & 0x80) {
+        // reset: also locks PRG mode 3
+        regs[MMC1_SHIFT] = 0;
+        regs[MMC1_COUNT] = 0;
+        regs[MMC1_CONTROL] |= 0x0C;
+        mmc1_prg (cpux);
+        return;
+    }
+
+    regs[MMC1_SHIFT] |= (data & 0x01) << regs[MMC1_COUNT];
+    if (++regs[MMC1_COUNT] < 5) {
+        return;
+    }
+
+    // 5th write: only the touched banks get re-mapped
+    switch ((address >> 13) & 0x03)
+    {
+    case 0:
+        regs[MMC1_CONTROL] = regs[MMC1_SHIFT];
+        mmc1_mirroring (cpux);
+        mmc1_chr (cpux);
+        mmc1_prg (cpux);
+        break;
+    case 1:
+        regs[MMC1_CHR0] = regs[MMC1_SHIFT];
+        mmc1_chr (cpux);
+        if (cpux->rom0->prg_rom_size > 16) {
+            mmc1_prg (cpux);
+        }
+        break;
+    case 2:
+        regs[MMC1_CHR1] = regs[MMC1_SHIFT];
+        mmc1_chr (cpux);
+        break;
+    case 3:
+        regs[MMC1_PRG] = regs[MMC1_SHIFT];
+        mmc1_prg (cpux);
+        break;
+    }
 
-        // Update the PPU's full map mirror
-        mirror (ppux->mmap, 0x4000, 0x0000, 16384);
-        mirror (ppux->mmap, 0x8000, 0x0000, 16384);
-        mirror (ppux->mmap, 0xC000, 0x0000, 16384);
+    regs[MMC1_SHIFT] = 0;
+    regs[MMC1_COUNT] = 0;
+}
 
-        // Setup Name Table Mirroring (should do elsewhere?)
-        if (romx->flg_mirroring == 0) {
-            // horizontal mirroring
-            mirror (ppux->mmap, 0x2400, 0x2000, 1024);
-            mirror (ppux->mmap, 0x2C00, 0x2800, 1024);
+static void
+mapper1_load (cpu_inst* cpux)
+{
+    mmc1_mirroring (cpux);
+    mmc1_chr (cpux);
+    mmc1_prg (cpux);
+}
+
+static void
+mapper1_init (cpu_inst* cpux)
+{
+    // power-on: PRG mode 3 (last bank fixed at $C000)
+    cpux->mapper_regs[MMC1_CONTROL] = 0x0C;
+    mapper1_load (cpux);
+}
+
+
+// Mapper 2 (UxROM): 16KB PRG bank at $8000 selected by any
+// write to $8000-$FFFF, last 16KB bank fixed at $C000.  CHR is
+// 8KB, fixed (almost always RAM).
+static void
+mapper2_write (cpu_inst* cpux, word address, byte data)
+{
+    cpux->mapper_regs[0] = data;
+    map_prg16 (cpux, 0x8000, data);
+}
+
+static void
+mapper2_load (cpu_inst* cpux)
+{
+    map_prg16 (cpux, 0x8000, cpux->mapper_regs[0]);
+}
+
+static void
+mapper2_init (cpu_inst* cpux)
+{
+    map_prg16 (cpux, 0xC000, cpux->rom0->prg_rom_size - 1);
+    map_chr8 (cpux, 0);
+    map_header_mirroring (cpux);
+    mapper2_load (cpux);
+}
+
+
+// Mapper 3 (CNROM): fixed PRG like NROM, 8KB CHR-ROM bank
+// selected by any write to $8000-$FFFF.
+static void
+mapper3_write (cpu_inst* cpux, word address, byte data)
+{
+    cpux->mapper_regs[0] = data;
+    map_chr8 (cpux, data);
+}
+
+static void
+mapper3_load (cpu_inst* cpux)
+{
+    map_chr8 (cpux, cpux->mapper_regs[0]);
+}
+
+static void
+mapper3_init (cpu_inst* cpux)
+{
+    map_prg16 (cpux, 0x8000, 0);
+    map_prg16 (cpux, 0xC000, cpux->rom0->prg_rom_size - 1);
+    map_header_mirroring (cpux);
+    mapper3_load (cpux);
+}
+
+
+// Mapper 4 (MMC3): 8KB PRG & 1KB/2KB CHR banking through 8 bank
+// registers, plus a scanline counter clocked by rising edges of
+// PPU A12.  Registers are address pairs (even/odd):
+//   $8000 bank select  $8001 bank data
+//   $A000 mirroring    $A001 PRG-RAM protect
+//   $C000 IRQ latch    $C001 IRQ reload
+//   $E000 IRQ disable  $E001 IRQ enable
+//
+// With the usual PPU setup (8x8 sprites, background & sprites on
+// different pattern tables) A12 rises once per rendered scanline,
+// on a known cycle.  The counter is then not clocked at all: its
+// value is worked out from the PPU clock whenever it is needed,
+// and the IRQ is scheduled with the CPU ahead of time.
+// Any other setup falls back to the PPU reporting every A12 rise.
+#define MMC3_SELECT     0       /* mapper_regs layout */
+#define MMC3_R          1       /* R0-R7: 1 ... 8     */
+#define MMC3_MIRROR     9
+#define MMC3_PROTECT    10
+#define MMC3_LATCH      11
+#define MMC3_COUNTER    12
+#define MMC3_RELOAD     13
+#define MMC3_ENABLE     14
+#define MMC3_CYCLE      15      /* A12 rise cycle / 4, 0 = exact */
+#define MMC3_SYNC       16      /* clock the counter is valid at */
+
+// Scanlines on which A12 rises: the pre-render line & 0 ... 239
+#define MMC3_FIRST_LINE     20  /* (scanline + 21) */
+#define MMC3_LINES          241
+
+static void
+mmc3_prg (cpu_inst* cpux)
+{
+    byte* regs = cpux->mapper_regs;
+    int last = 2*cpux->rom0->prg_rom_size - 1;
+
+    if (regs[MMC3_SELECT] & 0x40) {
+        map_prg8 (cpux, 0x8000, last - 1);
+        map_prg8 (cpux, 0xC000, regs[MMC3_R + 6]);
+    } else {
+        map_prg8 (cpux, 0x8000, regs[MMC3_R + 6]);
+        map_prg8 (cpux, 0xC000, last - 1);
+    }
+    map_prg8 (cpux, 0xA000, regs[MMC3_R + 7]);
+    map_prg8 (cpux, 0xE000, last);
+}
+
+static void
+mmc3_chr (cpu_inst* cpux)
+{
+    byte* regs = cpux->mapper_regs;
+    word inv = (regs[MMC3_SELECT] & 0x80) ? 0x1000 : 0x0000;
+
+    // R0 & R1 are 2KB banks (low bit ignored)
+    map_chr1 (cpux, inv ^ 0x0000, regs[MMC3_R + 0] & ~1);
+    map_chr1 (cpux, inv ^ 0x0400, regs[MMC3_R + 0] |  1);
+    map_chr1 (cpux, inv ^ 0x0800, regs[MMC3_R + 1] & ~1);
+    map_chr1 (cpux, inv ^ 0x0C00, regs[MMC3_R + 1] |  1);
+    map_chr1 (cpux, inv ^ 0x1000, regs[MMC3_R + 2]);
+    map_chr1 (cpux, inv ^ 0x1400, regs[MMC3_R + 3]);
+    map_chr1 (cpux, inv ^ 0x1800, regs[MMC3_R + 4]);
+    map_chr1 (cpux, inv ^ 0x1C00, regs[MMC3_R + 5]);
+}
+
+static void
+mmc3_mirroring (cpu_inst* cpux)
+{
+    // 4-screen boards have their own VRAM & ignore $A000
+    if (cpux->rom0->flg_mirroring == MIRROR_FOUR_SCREEN) {
+        map_header_mirroring (cpux);
+    } else if (cpux->mapper_regs[MMC3_MIRROR] & 0x01) {
+        set_mirroring (cpux->ppux, MIRROR_HORIZONTAL);
+    } else {
+        set_mirroring (cpux->ppux, MIRROR_VERTICAL);
+    }
+}
+
+// Cycle (/4) of the one A12 rise per scanline, or 0 if the PPU
+// is not set up that way
+static byte
+mmc3_a12_cycle (ppu_inst* ppux)
+{
+    byte ctrl = ppux->PPUCTRL;
+
+    if (!(ppux->PPUMASK & 0x18) || (ctrl & 0x20)) {
+        return 0;       // not rendering, or 8x16 sprites
+    }
+    if ((ctrl & 0x08) && !(ctrl & 0x10)) {
+        return 260/4;   // sprites @ $1000: first sprite fetch
+    }
+    if ((ctrl & 0x10) && !(ctrl & 0x08)) {
+        return 324/4;   // background @ $1000: next line's 1st tile
+    }
+    return 0;
+}
+
+// # of A12 rises before clock t (one per scanline at cycle c)
+static unsigned long long
+mmc3_rises (unsigned long long t, int c)
+{
+    unsigned long long frames = t / PPU_FRAME_CYCLES;
+    int r = (int)(t % PPU_FRAME_CYCLES);
+    int n = 0;
+
+    if (r > c) {
+        n = (r - c - 1) / PPU_LINE_CYCLES - (MMC3_FIRST_LINE - 1);
+        n = (n < 0) ? 0 : (n > MMC3_LINES) ? MMC3_LINES : n;
+    }
+    return frames * MMC3_LINES + n;
+}
+
+// Clock of A12 rise # k (counting from 0 at power-on)
+static unsigned long long
+mmc3_rise_clock (unsigned long long k, int c)
+{
+    return (k / MMC3_LINES) * PPU_FRAME_CYCLES
+         + (MMC3_FIRST_LINE + (int)(k % MMC3_LINES)) * PPU_LINE_CYCLES + c;
+}
+
+// Applies n counter clocks at once
+static void
+mmc3_count (byte* regs, unsigned long long n)
+{
+    unsigned long long period = regs[MMC3_LATCH] + 1;
+    unsigned long long m;
+
+    if (!n) {
+        return;
+    }
+
+    // reload on the first clock if asked to (or if at 0)
+    if (regs[MMC3_RELOAD] || !regs[MMC3_COUNTER]) {
+        regs[MMC3_COUNTER] = regs[MMC3_LATCH];
+        regs[MMC3_RELOAD] = 0;
+        n--;
+    }
+
+    // count down to 0, then reload & repeat every latch+1 clocks
+    if (n <= regs[MMC3_COUNTER]) {
+        regs[MMC3_COUNTER] -= n;
+    } else {
+        m = (n - regs[MMC3_COUNTER]) % period;
+        regs[MMC3_COUNTER] = m ? (byte)(period - m) : 0;
+    }
+}
+
+// Brings the counter up to the current PPU clock
+static void
+mmc3_sync (cpu_inst* cpux)
+{
+    byte* regs = cpux->mapper_regs;
+    unsigned long long now = cpux->ppux->clock;
+    unsigned long long then;
+    int c = 4*regs[MMC3_CYCLE];
+
+    memcpy (&then, &regs[MMC3_SYNC], sizeof(then));
+    if (c) {
+        mmc3_count (regs, mmc3_rises (now, c) - mmc3_rises (then, c));
+    }
+    memcpy (&regs[MMC3_SYNC], &now, sizeof(now));
+}
+
+// Picks analytic or exact counting for the current PPU setup,
+// and schedules the next IRQ if it can be known ahead of time
+static void
+mmc3_schedule (cpu_inst* cpux)
+{
+    byte* regs = cpux->mapper_regs;
+    ppu_inst* ppux = cpux->ppux;
+    unsigned long long k;
+    int c;
+
+    regs[MMC3_CYCLE] = mmc3_a12_cycle (ppux);
+    c = 4*regs[MMC3_CYCLE];
+
+    ppux->a12_exact = !c;
+
+    if (!c || !regs[MMC3_ENABLE]) {
+        irq_schedule (cpux, IRQ_MAPPER, PPU_NEVER);
+        return;
+    }
+
+    // # of clocks until the counter next reaches 0
+    if (regs[MMC3_RELOAD] || !regs[MMC3_COUNTER]) {
+        k = 1 + regs[MMC3_LATCH];
+    } else {
+        k = regs[MMC3_COUNTER];
+    }
+
+    // (asserts just after the PPU cycle of that rise).  Later
+    // zeros need no scheduling: the line stays asserted until
+    // $E000, which reschedules from there.
+    k += mmc3_rises (ppux->clock, c) - 1;
+    irq_schedule (cpux, IRQ_MAPPER, mmc3_rise_clock (k, c) + 1);
+}
+
+static void
+mapper4_a12 (cpu_inst* cpux)
+{
+    byte* regs = cpux->mapper_regs;
+
+    mmc3_count (regs, 1);
+    if (!regs[MMC3_COUNTER] && regs[MMC3_ENABLE]) {
+        irq_schedule (cpux, IRQ_MAPPER, cpux->ppux->clock);
+    }
+}
+
+static void
+mapper4_ppu_config (cpu_inst* cpux)
+{
+    // count up to now the old way, then switch
+    mmc3_sync (cpux);
+    mmc3_schedule (cpux);
+}
+
+// Saved states hold the counter as of the moment of the save
+static void
+mapper4_save (cpu_inst* cpux)
+{
+    mmc3_sync (cpux);
+}
+
+static void
+mapper4_write (cpu_inst* cpux, word address, byte data)
+{
+    byte* regs = cpux->mapper_regs;
+
+    switch (address & 0xE001)
+    {
+    case 0x8000:
+        regs[MMC3_SELECT] = data;
+        mmc3_prg (cpux);
+        mmc3_chr (cpux);
+        break;
+    case 0x8001:
+        regs[MMC3_R + (regs[MMC3_SELECT] & 0x07)] = data;
+        if ((regs[MMC3_SELECT] & 0x07) >= 6) {
+            mmc3_prg (cpux);
         } else {
-            // vertical mirroring
-            mirror (ppux->mmap, 0x2800, 0x2000, 1024);
-            mirror (ppux->mmap, 0x2C00, 0x2400, 1024);
+            mmc3_chr (cpux);
         }
+        break;
+    case 0xA000:
+        regs[MMC3_MIRROR] = data;
+        mmc3_mirroring (cpux);
+        break;
+    case 0xA001:
+        // (kept for save states; SRAM stays enabled & writable,
+        // since MMC6 boards use this register differently)
+        regs[MMC3_PROTECT] = data;
+        break;
+
+    // IRQ registers: count up to now under the old settings first
+    case 0xC000:
+        mmc3_sync (cpux);
+        regs[MMC3_LATCH] = data;
+        mmc3_schedule (cpux);
+        break;
+    case 0xC001:
+        mmc3_sync (cpux);
+        regs[MMC3_COUNTER] = 0;
+        regs[MMC3_RELOAD] = 1;
+        mmc3_schedule (cpux);
+        break;
+    case 0xE000:
+        mmc3_sync (cpux);
+        regs[MMC3_ENABLE] = 0;
+        irq_release (cpux, IRQ_MAPPER);
+        mmc3_schedule (cpux);
+        break;
+    case 0xE001:
+        mmc3_sync (cpux);
+        regs[MMC3_ENABLE] = 1;
+        mmc3_schedule (cpux);
+        break;
+    }
+}
+
+static void
+mapper4_load (cpu_inst* cpux)
+{
+    mmc3_prg (cpux);
+    mmc3_chr (cpux);
+    mmc3_mirroring (cpux);
+    mmc3_schedule (cpux);
+}
+
+static void
+mapper4_init (cpu_inst* cpux)
+{
+    memcpy (&cpux->mapper_regs[MMC3_SYNC], &cpux->ppux->clock,
+            sizeof(cpux->ppux->clock));
+    mapper4_load (cpux);
+}
+
+
+// Mapper 7 (AxROM): 32KB PRG bank (bits 2-0) and single screen
+// name table select (bit 4) written to $8000-$FFFF.  CHR-RAM.
+static void
+mapper7_load (cpu_inst* cpux)
+{
+    byte reg = cpux->mapper_regs[0];
+
+    map_prg32 (cpux, reg & 0x07);
+    set_mirroring (cpux->ppux, (reg & 0x10) ? MIRROR_SINGLE_B : MIRROR_SINGLE_A);
+}
+
+static void
+mapper7_write (cpu_inst* cpux, word address, byte data)
+{
+    cpux->mapper_regs[0] = data;
+    mapper7_load (cpux);
+}
+
+static void
+mapper7_init (cpu_inst* cpux)
+{
+    map_chr8 (cpux, 0);
+    mapper7_load (cpux);
+}
+
+
+// Mappers 9 (MMC2) & 10 (MMC4): two 4KB CHR banks, each with a
+// latch picking one of two bank registers.  The latches are set
+// by the PPU itself fetching tile $FD or $FE (see latch_bg in
+// 2C02.c), which lets a game swap tiles mid-frame for free.
+//   $A000 PRG bank (MMC2: 8KB @ $8000, MMC4: 16KB @ $8000)
+//   $B000 CHR $0000 when latch 0 = $FD   $C000 ... = $FE
+//   $D000 CHR $1000 when latch 1 = $FD   $E000 ... = $FE
+//   $F000 mirroring (0: vertical, 1: horizontal)
+// The rest of PRG is fixed to the end of the ROM.
+#define MMC2_PRG        0       /* mapper_regs layout */
+#define MMC2_CHR0_FD    1
+#define MMC2_CHR0_FE    2
+#define MMC2_CHR1_FD    3
+#define MMC2_CHR1_FE    4
+#define MMC2_MIRROR     5
+#define MMC2_LATCH0     6       /* $FD or $FE */
+#define MMC2_LATCH1     7
+
+static void
+mmc2_prg (cpu_inst* cpux)
+{
+    int last = 2*cpux->rom0->prg_rom_size - 1;      /* 8KB banks */
 
+    if (cpux->mapper->id == 10) {
+        map_prg16 (cpux, 0x8000, cpux->mapper_regs[MMC2_PRG]);
+        map_prg16 (cpux, 0xC000, cpux->rom0->prg_rom_size - 1);
     } else {
-        // Do nothing... static memory mapping
+        map_prg8 (cpux, 0x8000, cpux->mapper_regs[MMC2_PRG]);
+        map_prg8 (cpux, 0xA000, last - 2);
+        map_prg8 (cpux, 0xC000, last - 1);
+        map_prg8 (cpux, 0xE000, last);
     }
 }
 
 static void
-mapper_null (cpu_inst* cpux, int init)
+mmc2_chr0 (cpu_inst* cpux)
 {
-    printf ("Mapper not yet implemented.\nExiting...\n\n");
-    exit (0);
+    byte* regs = cpux->mapper_regs;
+
+    map_chr4 (cpux, 0x0000, (regs[MMC2_LATCH0] == 0xFD) ?
+                            regs[MMC2_CHR0_FD] : regs[MMC2_CHR0_FE]);
+}
+
+static void
+mmc2_chr1 (cpu_inst* cpux)
+{
+    byte* regs = cpux->mapper_regs;
+
+    map_chr4 (cpux, 0x1000, (regs[MMC2_LATCH1] == 0xFD) ?
+                            regs[MMC2_CHR1_FD] : regs[MMC2_CHR1_FE]);
+}
+
+static void
+mmc2_mirroring (cpu_inst* cpux)
+{
+    if (cpux->mapper_regs[MMC2_MIRROR] & 0x01) {
+        set_mirroring (cpux->ppux, MIRROR_HORIZONTAL);
+    } else {
+        set_mirroring (cpux->ppux, MIRROR_VERTICAL);
+    }
+}
+
+static void
+mmc2_write (cpu_inst* cpux, word address, byte data)
+{
+    byte* regs = cpux->mapper_regs;
+
+    switch (address & 0xF000)
+    {
+    case 0xA000:
+        regs[MMC2_PRG] = data & 0x0F;
+        mmc2_prg (cpux);
+        break;
+    case 0xB000:
+        regs[MMC2_CHR0_FD] = data & 0x1F;
+        mmc2_chr0 (cpux);
+        break;
+    case 0xC000:
+        regs[MMC2_CHR0_FE] = data & 0x1F;
+        mmc2_chr0 (cpux);
+        break;
+    case 0xD000:
+        regs[MMC2_CHR1_FD] = data & 0x1F;
+        mmc2_chr1 (cpux);
+        break;
+    case 0xE000:
+        regs[MMC2_CHR1_FE] = data & 0x1F;
+        mmc2_chr1 (cpux);
+        break;
+    case 0xF000:
+        regs[MMC2_MIRROR] = data & 0x01;
+        mmc2_mirroring (cpux);
+        break;
+    }
+}
+
+// A latch tile was fetched.  MMC2's latch 0 only reacts to the
+// first row ($0FD8 / $0FE8); MMC4 & MMC2's latch 1 to any row.
+static void
+mmc2_latch (cpu_inst* cpux, word address)
+{
+    byte* regs = cpux->mapper_regs;
+    byte tile = (address >> 4) & 0xFF;
+
+    if (address & 0x1000) {
+        if (regs[MMC2_LATCH1] != tile) {
+            regs[MMC2_LATCH1] = tile;
+            mmc2_chr1 (cpux);
+        }
+    } else if ((cpux->mapper->id == 10) || ((address & 0x0F) == 0x08)) {
+        if (regs[MMC2_LATCH0] != tile) {
+            regs[MMC2_LATCH0] = tile;
+            mmc2_chr0 (cpux);
+        }
+    }
+}
+
+static void
+mmc2_load (cpu_inst* cpux)
+{
+    mmc2_prg (cpux);
+    mmc2_chr0 (cpux);
+    mmc2_chr1 (cpux);
+    mmc2_mirroring (cpux);
+}
+
+static void
+mmc2_init (cpu_inst* cpux)
+{
+    cpux->mapper_regs[MMC2_LATCH0] = 0xFE;
+    cpux->mapper_regs[MMC2_LATCH1] = 0xFE;
+    cpux->ppux->chr_latch = 1;
+    mmc2_load (cpux);
 }
 
 
+// The mapper registry.  Read-only & shared by every instance;
+// hooks a board doesn't need are 0 and cost nothing.
+static const mapper_desc nes_mappers[] = {
+    {   .id = 0,
+        .init = mapper0_init,
+    },
+    {   .id = 1,
+        .init = mapper1_init,
+        .write = mapper1_write,
+        .load = mapper1_load,
+    },
+    {   .id = 2,
+        .init = mapper2_init,
+        .write = mapper2_write,
+        .load = mapper2_load,
+    },
+    {   .id = 3,
+        .init = mapper3_init,
+        .write = mapper3_write,
+        .load = mapper3_load,
+    },
+    {   .id = 4,
+        .init = mapper4_init,
+        .write = mapper4_write,
+        .a12 = mapper4_a12,
+        .ppu_config = mapper4_ppu_config,
+        .save = mapper4_save,
+        .load = mapper4_load,
+    },
+    {   .id = 7,
+        .init = mapper7_init,
+        .write = mapper7_write,
+        .load = mapper7_load,
+    },
+    {   .id = 9,
+        .init = mmc2_init,
+        .write = mmc2_write,
+        .latch = mmc2_latch,
+        .load = mmc2_load,
+    },
+    {   .id = 10,
+        .init = mmc2_init,
+        .write = mmc2_write,
+        .latch = mmc2_latch,
+        .load = mmc2_load,
+    },
+};
+
+// Until a ROM is attached: a board with nothing on it
+static const mapper_desc no_mapper = { .id = -1 };
+
+
 /********************************************************************
  * E N G I N E     I N T E R F A C E S                              *
  ********************************************************************/
@@ -153,36 +1005,35 @@ mapper_null (cpu_inst* cpux, int init)
 void
 init_nes_memorymap (cpu_inst* cpux, ppu_inst* ppux)
 {
-    int i,j;
-    byte *RAM;          /* CPU RAM                   */
-    byte *SRAM;         /* CPU Save RAM              */
-    byte *UNK;          /* UNKNOWN                   */
-    byte *TABLES;       /* PPU Name/Attribute Tables */
-    byte *PALETTES;     /* PPU Palettes              */
-    byte *OAM;          /* Sprite RAM (OAM)          */
+    nes_memory *mem;
+    int i;
 
-    // Piggyback the ppu onto the cpu
+    // Piggyback the ppu onto the cpu (& let it call back)
     cpux->ppux = ppux;
+    ppux->cpux = cpux;
+
+    // Every byte of mutable memory lives in one block.  Instances
+    // from make_instance bring their own (inside the arena).
+    if (!cpux->mem) {
+        cpux->mem = (nes_memory*) malloc (sizeof(nes_memory));
+    }
+    mem = cpux->mem;
+    memset (mem, 0, sizeof(nes_memory));
 
     /******************
      * CPU Memory Map *
      ******************/
-
-    /* Setup RAMs and IO for 6502 Memory Map */
-    RAM  = (byte*) malloc (2048 * sizeof(byte));
-    SRAM = (byte*) malloc (8192 * sizeof(byte));
-    UNK  = (byte*) malloc (8192 * sizeof(byte));   // Unknown address space
-
-    /* Extra 0x8000 is for PRG-ROM shadow */
-    cpux->mmap = (byte**) malloc (0x18000 * sizeof(byte*));
-
-    memset (RAM, 0, 2048 * sizeof(byte));
+    cpux->RAM  = mem->RAM;
+    cpux->SRAM = mem->SRAM;
+    cpux->EXP  = mem->EXP;
+    memset (cpux->mapper_regs, 0, MAPPER_REGS);
 
     /* Basic 6502 Memory Map stuff   */
-    /* Map RAM  into 0x0000 - 0x1FFF */
+    /* Map RAM  into 0x0000 - 0x07FF */
     /* Map SRAM into 0x6000 - 0x7FFF */
-    swap_in (cpux->mmap, 0x0000, RAM, 0x0000, 2048);
-    swap_in (cpux->mmap, 0x6000, SRAM, 0x0000, 8192);
+    swap_in (cpux->mmap, 0x0000, mem->RAM, 0x0000, 2048);
+    swap_in (cpux->mmap, 0x6000, mem->SRAM, 0x0000, 8192);
+    cpux->sram_enabled = 1;
 
     /* RAM Mirrors */
     /* 0x0800-0x0FFF mirrors 0x0000-0x07FF */
@@ -192,156 +1043,596 @@ init_nes_memorymap (cpu_inst* cpux, ppu_inst* ppux)
     mirror (cpux->mmap, 0x1000, 0x0000, 2048);
     mirror (cpux->mmap, 0x1800, 0x0000, 2048);
 
+    /* I/O registers are handled by read_mem/write_mem, but DMA
+     * may still point at them: give them a harmless page */
+    for (i=0x2000; i<0x4000; i+=MMAP_PAGE_SIZE) {
+        swap_in (cpux->mmap, i, mem->OPENBUS, 0x0000, MMAP_PAGE_SIZE);
+    }
+
     /* Temporary memory allocation for Expansion ROM range */
     /* 0x4000-0x401F is Mapper I/O? and 0x4020-0x6000 is Expansion ROM */
-    swap_in (cpux->mmap, 0x4000, UNK, 0x0000, 8192);
+    swap_in (cpux->mmap, 0x4000, mem->EXP, 0x0000, 8192);
+
+    /* Until a mapper says otherwise, PRG-ROM space is open bus too */
+    for (i=0x8000; i<0x10000; i+=MMAP_PAGE_SIZE) {
+        swap_in (cpux->mmap, i, mem->OPENBUS, 0x0000, MMAP_PAGE_SIZE);
+    }
 
 
     /******************
      * PPU Memory Map *
      ******************/
-    ppux->mmap = (byte**) malloc (0x10000 * sizeof(byte*));
+    /* Just assign OAM & palettes. They don't live in the PPU memory map. */
+    ppux->OAM = mem->OAM;
+    ppux->TABLES = mem->TABLES;
+    ppux->PALETTES = mem->PALETTES;
 
-    /* For all Name Tables and Attribute Tables */
-    TABLES   = (byte*) malloc (4096 * sizeof(byte));
-    PALETTES = (byte*) malloc (  32 * sizeof(byte));
-    OAM      = (byte*) malloc ( 256 * sizeof(byte));
+    /* Basic 2C02 Memory Map stuff       */
+    /* Map TABLES   into 0x2000 - 0x2FFF */
+    /* (mirroring is up to the mapper)   */
+    set_mirroring (ppux, MIRROR_FOUR_SCREEN);
 
-    memset (TABLES  , 0, 4096 * sizeof(byte));
-    memset (PALETTES, 0,   32 * sizeof(byte));
-    memset (OAM     , 0,  256 * sizeof(byte));
+    /* Mirrors in PPU memory map are folded by ppu_byte: */
+    /* 0x3000-0x3EFF mirrors 0x2000-0x2EFF (pages unused) */
+    /* 0x3F00-0x3FFF is palettes                          */
+    /* 0x4000-0xFFFF mirrors 0x0000-0x3FFF                */
 
-    /* Just assign OAM. It doesn't live in the PPU memory map. */
-    ppux->OAM = OAM;
-    
-    /* Basic 2C02 Memory Map stuff   */
-    /* Map TABLES   into 0x2000 - 0x2FFF */
-    /* Map PALETTES into 0x3F00 - 0x3F1F */
-    swap_in (ppux->mmap, 0x2000, TABLES, 0x0000, 4096);
-    swap_in (ppux->mmap, 0x3F00, PALETTES, 0x0000, 32);
-
-    /* Setup mirrors in PPU memory map     */
-    /* 0x3000-0x3EFF mirrors 0x2000-0x2EFF */
-    /* 0x3F20-0x3FFF mirrors 0x3F00-0x3F1F */
-    /* 0x4000-0x7FFF mirrors 0x0000-0x3FFF */
-    /* 0x8000-0xCFFF mirrors 0x0000-0x3FFF */
-    mirror (ppux->mmap, 0x3000, 0x2000, 3840);
-    mirror (ppux->mmap, 0x3F20, 0x3F00, 32);
-    mirror (ppux->mmap, 0x3F40, 0x3F00, 32);
-    mirror (ppux->mmap, 0x3F60, 0x3F00, 32);
-    mirror (ppux->mmap, 0x3F80, 0x3F00, 32);
-    mirror (ppux->mmap, 0x3FA0, 0x3F00, 32);
-    mirror (ppux->mmap, 0x3FC0, 0x3F00, 32);
-    mirror (ppux->mmap, 0x3FE0, 0x3F00, 32);
-    mirror (ppux->mmap, 0x4000, 0x0000, 16384);
-    mirror (ppux->mmap, 0x8000, 0x0000, 16384);
-    mirror (ppux->mmap, 0xC000, 0x0000, 16384);
+    /* CHR-ROM/RAM pages are up to the mapper */
+    swap_in (ppux->mmap, 0x0000, mem->OPENBUS, 0x0000, MMAP_PAGE_SIZE);
+    mirror (ppux->mmap, 0x0400, 0x0000, MMAP_PAGE_SIZE);
+    mirror (ppux->mmap, 0x0800, 0x0000, 2*MMAP_PAGE_SIZE);
+    mirror (ppux->mmap, 0x1000, 0x0000, 4*MMAP_PAGE_SIZE);
 
 
-    /******************
-     * Memory Mappers *
-     ******************/
-    /* Allocate Memory Mappers function pointer table */
-    cpux->mapper = malloc (sizeof(void(*)(cpu_inst* cpux, int init)) * 256);
-
-    /* Initialize Memory Mappers */
-    cpux->mapper[0] = mapper0;
-    cpux->mapper[1] = mapper_null;
-    cpux->mapper[2] = mapper0;
-    cpux->mapper[3] = mapper_null;
-    cpux->mapper[4] = mapper_null;
-    cpux->mapper[5] = mapper_null;
-    cpux->mapper[6] = mapper_null;
-    cpux->mapper[7] = mapper_null;
-    cpux->mapper[8] = mapper_null;
-    cpux->mapper[9] = mapper_null;
-    cpux->mapper[10] = mapper_null;
-    cpux->mapper[11] = mapper_null;
-    cpux->mapper[12] = mapper_null;
-    cpux->mapper[15] = mapper_null;
-    cpux->mapper[16] = mapper_null;
-    cpux->mapper[17] = mapper_null;
-    cpux->mapper[18] = mapper_null;
-    cpux->mapper[19] = mapper_null;
-    cpux->mapper[20] = mapper_null;
-    cpux->mapper[21] = mapper_null;
-    cpux->mapper[22] = mapper_null;
-    cpux->mapper[23] = mapper_null;
-    cpux->mapper[24] = mapper_null;
-    cpux->mapper[25] = mapper_null;
-    cpux->mapper[32] = mapper_null;
-    cpux->mapper[33] = mapper_null;
-    cpux->mapper[34] = mapper_null;
-    cpux->mapper[64] = mapper_null;
-    cpux->mapper[65] = mapper_null;
-    cpux->mapper[66] = mapper_null;
-    cpux->mapper[67] = mapper_null;
-    cpux->mapper[68] = mapper_null;
-    cpux->mapper[69] = mapper_null;
-    cpux->mapper[71] = mapper_null;
-    cpux->mapper[78] = mapper_null;
-    cpux->mapper[91] = mapper_null;
+    /* No cartridge yet (see attach_rom) */
+    cpux->mapper = &no_mapper;
 }
 
 
-// Provides an abstraction for reading from memory
-inline byte
-read_mem (word address, cpu_inst* cpux)
+void
+destroy_nes_memorymap (cpu_inst* cpux)
+{
+    // Only memory that is not part of an instance arena is ours
+    if ((byte*) cpux->mem != (byte*) cpux + ARENA_MEM) {
+        free (cpux->mem);
+    }
+    cpux->mapper = 0;
+    cpux->mem = 0;
+}
+
+
+const mapper_desc*
+find_mapper (int id)
+{
+    int i;
+
+    for (i=0; i<sizeof(nes_mappers)/sizeof(nes_mappers[0]); i++) {
+        if (nes_mappers[i].id == id) {
+            return &nes_mappers[i];
+        }
+    }
+    return 0;
+}
+
+
+int
+attach_rom (cpu_inst* cpux, nes_rom* rom)
+{
+    const mapper_desc *mapper = find_mapper (rom->mapper);
+
+    if (!mapper) {
+        return -1;
+    }
+
+    cpux->rom0 = rom;
+    cpux->mapper_id = rom->mapper;
+    cpux->mapper = mapper;
+    mapper->init (cpux);
+
+    return 0;
+}
+
+
+// ----------
+
+
+// One cache line aligned block per instance (see memory.h)
+static byte*
+alloc_arena ()
+{
+    byte *arena;
+
+#if defined (_WIN32)
+    arena = (byte*) _aligned_malloc (ARENA_SIZE, ARENA_ALIGN);
+    if (!arena) {
+#else
+    if (posix_memalign ((void**) &arena, ARENA_ALIGN, ARENA_SIZE)) {
+#endif
+        printf ("Unable to allocate emulator instance.\nExiting...\n\n");
+        exit (0);
+    }
+
+    return arena;
+}
+
+
+cpu_inst*
+make_instance (cpu_luts* luts)
+{
+    byte *arena;
+    cpu_inst *cpux;
+    ppu_inst *ppux;
+
+    arena = alloc_arena ();
+
+    cpux = (cpu_inst*) (arena + ARENA_CPU);
+    ppux = (ppu_inst*) (arena + ARENA_PPU);
+
+    init_cpu (cpux, luts);
+    init_ppu (ppux);
+
+    cpux->mem = (nes_memory*) (arena + ARENA_MEM);
+    init_nes_memorymap (cpux, ppux);
+
+    return cpux;
+}
+
+
+void
+reset_instance (cpu_inst* cpux)
+{
+    ppu_inst *ppux = cpux->ppux;
+    disp_inst *displayx = ppux->displayx;
+    nes_rom *rom = cpux->rom0;
+    const mapper_desc *mapper = cpux->mapper;
+    byte mapper_id = cpux->mapper_id;
+    byte *sram = cpux->SRAM;
+    nes_memory *mem = cpux->mem;
+    cpu_luts luts;
+#if defined (COROUTINES)
+    struct coro_instance *coro = ppux->coro;
+    struct coro_instance *host = ppux->host;
+#endif
+
+    luts.opcode = cpux->opcode;
+    luts.amode  = cpux->amode;
+    luts.cycles = cpux->cycles;
+
+    // Power-on registers & a cleared memory map (keeping the
+    // memory block, LUTs, ROM & display this instance already has)
+    init_cpu (cpux, &luts);
+    init_ppu (ppux);
+    cpux->mem = mem;
+    init_nes_memorymap (cpux, ppux);
+
+    ppux->displayx = displayx;
+#if defined (COROUTINES)
+    ppux->coro = coro;
+    ppux->host = host;
+#endif
+    cpux->rom0 = rom;
+    cpux->mapper_id = mapper_id;
+    cpux->mapper = mapper;
+
+    // Battery SRAM survives a power cycle
+    if (sram != mem->SRAM) {
+        cpux->SRAM = sram;
+        swap_in (cpux->mmap, 0x6000, sram, 0x0000, sizeof(mem->SRAM));
+    }
+
+    if (rom) {
+        mapper->init (cpux);
+        reset_cpu (cpux);
+    }
+}
+
+
+// Copies the pointers of a freshly memcpy'd arena that pointed
+// into the source arena over to the same offset in the copy.
+// ROM pages & LUTs are outside of the arena and stay shared.
+#define REBASE(ptr)                                                     \
+    do {                                                                \
+        if (((byte*)(ptr) >= (byte*) src) &&                            \
+            ((byte*)(ptr) <  (byte*) src + ARENA_SIZE)) {               \
+            (ptr) = (void*) ((byte*)(ptr) + offset);                    \
+        }                                                               \
+    } while (0)
+
+void
+copy_instance (cpu_inst* dst, cpu_inst* src)
+{
+    ppu_inst *ppux;
+    disp_inst *displayx = dst->ppux->displayx;
+#if defined (COROUTINES)
+    struct coro_instance *coro = dst->ppux->coro;
+    struct coro_instance *host = dst->ppux->host;
+#endif
+    byte *dst_sram = dst->SRAM;
+    nes_memory *mem;
+    byte *arena_sram;
+    ptrdiff_t offset = (byte*) dst - (byte*) src;
+    int i;
+
+    memcpy (dst, src, ARENA_SIZE);
+
+    ppux = (ppu_inst*) ((byte*) dst + ARENA_PPU);
+    mem  = (nes_memory*) ((byte*) dst + ARENA_MEM);
+    arena_sram = mem->SRAM;
+
+    REBASE (dst->ppux);
+    REBASE (ppux->cpux);
+    REBASE (dst->mem);
+    REBASE (dst->RAM);
+    REBASE (dst->SRAM);
+    REBASE (dst->EXP);
+    REBASE (ppux->OAM);
+    REBASE (ppux->TABLES);
+    REBASE (ppux->PALETTES);
+    for (i=0; i<CPU_PAGES; i++) {
+        REBASE (dst->mmap[i]);
+    }
+    for (i=0; i<PPU_PAGES; i++) {
+        REBASE (ppux->mmap[i]);
+    }
+
+    // Battery SRAM may be an external file mapping on either
+    // side: the contents move, but each keeps its own backing
+    if (src->SRAM != src->mem->SRAM) {
+        memcpy (arena_sram, src->SRAM, sizeof(mem->SRAM));
+        swap_in (dst->mmap, 0x6000, arena_sram, 0x0000, sizeof(mem->SRAM));
+        dst->SRAM = arena_sram;
+    }
+    if (dst_sram && (dst_sram != arena_sram)) {
+        memcpy (dst_sram, arena_sram, sizeof(mem->SRAM));
+        swap_in (dst->mmap, 0x6000, dst_sram, 0x0000, sizeof(mem->SRAM));
+        dst->SRAM = dst_sram;
+        __atomic_store_n (&dst->sram_dirty, 1, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n (&dst->sram_dirty, 0, __ATOMIC_RELEASE);
+    }
+
+    ppux->displayx = displayx;
+#if defined (COROUTINES)
+    ppux->coro = coro;          // (its stack holds no PPU state)
+    ppux->host = host;
+#endif
+}
+
+#undef REBASE
+
+
+cpu_inst*
+clone_instance (cpu_inst* src)
+{
+    byte *arena;
+    cpu_inst *cpux;
+    ppu_inst *ppux;
+
+    arena = alloc_arena ();
+
+    // Just enough for copy_instance to know the clone is
+    // headless and has no SRAM file of its own
+    cpux = (cpu_inst*) (arena + ARENA_CPU);
+    ppux = (ppu_inst*) (arena + ARENA_PPU);
+    cpux->ppux = ppux;
+    cpux->SRAM = 0;
+    ppux->displayx = 0;
+#if defined (COROUTINES)
+    ppux->coro = 0;
+    ppux->host = 0;
+#endif
+
+    copy_instance (cpux, src);
+    ppux->frame_ready = 0;
+
+    return cpux;
+}
+
+
+void
+destroy_instance (cpu_inst* cpux)
+{
+#if defined (COROUTINES)
+    destroy_ppu_coro (cpux->ppux);
+#endif
+#if defined (_WIN32)
+    _aligned_free (cpux);
+#else
+    free (cpux);
+#endif
+}
+
+
+// ----------
+//  I/O registers ($2000-$401F)
+//
+//  Every register has a read and a write handler.  The 8 PPU
+//  registers are mirrored all the way up to $3FFF, so they are
+//  indexed by (address & 7); $4000-$401F follow them.
+// ----------
+#define IO_REGS         (8 + 0x20)
+#define IO_REG(addr)    ((addr) < 0x4000 ? ((addr) & 0x07) : 0x08 + ((addr) & 0x1F))
+
+typedef byte (*io_reader) (cpu_inst* cpux, word address);
+typedef void (*io_writer) (cpu_inst* cpux, word address, byte data);
+
+
+// Write-only registers
+static byte
+io_none_read (cpu_inst* cpux, word address)
+{
+    return 0x00;
+}
+
+
+// Registers we do not emulate (yet) are just memory
+static byte
+io_mmap_read (cpu_inst* cpux, word address)
+{
+    return MMAP_BYTE (cpux->mmap, address);
+}
+
+
+static void
+io_mmap_write (cpu_inst* cpux, word address, byte data)
+{
+    MMAP_BYTE (cpux->mmap, address) = data;
+}
+
+
+static byte
+ppustatus_read (cpu_inst* cpux, word address)
 {
-    byte** mmap = cpux->mmap;
     ppu_inst* ppux = cpux->ppux;
 
-    run_ppu (ppux, 3);
+    PPU_SYNC (ppux);
 
-    // RAM, Stack, Zero Page
-    if (address < 0x2000) {
-        return *mmap[address];
-    }
-
-    // I/O Block Reads
-    else if ((address >= 0x2000) && (address < 0x4000)) {
-        // Because the I/O register map is highly mirrored 
-        switch (address % 8)
-        {
-        case 0x00:  // PPUCTRL
-        case 0x01:  // PPUMASK
-        case 0x03:  // OAMADDR
-        case 0x04:  // OAMDATA  (only Micromachines reads this?)
-        case 0x05:  // PPUSCROLL
-        case 0x06:  // PPUADDR
-            break;
-
-        // PPUSTATUS
-        case 0x02:
-            ppux->T1 = ppux->PPUSTATUS;
-            ppux->PPUSTATUS &= ~0x80;
-            return ppux->T1;
-            break;
-
-
-        // PPUDATA
-        case 0x07:
-            ppux->T1 = *ppux->mmap[ppux->PPUADDR];
-
-            if ((ppux->PPUCTRL & 0x04)) {
-                ppux->PPUADDR += 32;
-            } else {
-                ppux->PPUADDR++;
-            }
-            return ppux->T1;
-            break;
+    ppux->T1 = ppux->PPUSTATUS;
+    ppux->PPUSTATUS &= ~0x80;
+    return ppux->T1;
+}
+
+
+static byte
+ppudata_read (cpu_inst* cpux, word address)
+{
+    ppu_inst* ppux = cpux->ppux;
+
+    PPU_SYNC (ppux);
+
+    ppux->T1 = *ppu_byte (ppux, ppux->PPUADDR);
+
+    if ((ppux->PPUCTRL & 0x04)) {
+        ppux->PPUADDR += 32;
+    } else {
+        ppux->PPUADDR++;
+    }
+    return ppux->T1;
+}
+
+
+// Every PPU register write starts here
+static inline ppu_inst*
+ppu_io_write (cpu_inst* cpux, byte data)
+{
+    ppu_inst* ppux = cpux->ppux;
+
+    PPU_SYNC (ppux);
+
+    // Last write to PPU I/O is held in PPUSTATUS
+    ppux->PPUSTATUS |= (0x1F & data);
+
+    return ppux;
+}
+
+
+static void
+ppuctrl_write (cpu_inst* cpux, word address, byte data)
+{
+    ppu_inst* ppux = ppu_io_write (cpux, data);
+
+    ppux->PPUCTRL = data;
+
+    // Lower 2 bits into B11-B10 of latch
+    ppux->PPULATCH |= (0x03 & data) << 10;
+
+    if (cpux->mapper->ppu_config) {
+        cpux->mapper->ppu_config (cpux);
+    }
+}
+
+
+static void
+ppumask_write (cpu_inst* cpux, word address, byte data)
+{
+    ppu_inst* ppux = ppu_io_write (cpux, data);
+
+    ppux->PPUMASK = data;
+
+    if (cpux->mapper->ppu_config) {
+        cpux->mapper->ppu_config (cpux);
+    }
+}
+
+
+static void
+ppustatus_write (cpu_inst* cpux, word address, byte data)
+{
+    // (cannot be written)
+    ppu_io_write (cpux, data);
+}
+
+
+static void
+oamaddr_write (cpu_inst* cpux, word address, byte data)
+{
+    ppu_inst* ppux = ppu_io_write (cpux, data);
+
+    ppux->OAMADDR = data;
+}
+
+
+static void
+oamdata_write (cpu_inst* cpux, word address, byte data)
+{
+    ppu_inst* ppux = ppu_io_write (cpux, data);
+
+    // (writes cause OAMADDR to increment)
+    ppux->OAMDATA = data;
+    ppux->OAM[ppux->OAMADDR++] = ppux->OAMDATA;
+}
+
+
+static void
+ppuscroll_write (cpu_inst* cpux, word address, byte data)
+{
+    ppu_inst* ppux = ppu_io_write (cpux, data);
+
+    // (writes are two operations)
+    if (ppux->flipflop) {
+        // (2nd write - Vertical Scroll Offset)
+        /* Lower 3 bits into B14-B12 of latch */
+        ppux->PPULATCH |= (0x07 & data) << 12;
+        /* Upper 5 bits into B9-B5 of latch */
+        ppux->PPULATCH |= (data >> 3) << 5;
+    } else {
+        // (1st write - Horizontal Scroll Offset)
+        /* Lower 3 bits define fine scroll */
+        ppux->FINESCROLL = (0x07 & data);
+        /* Upper 5 bits into B4-B0 of latch  */
+        ppux->PPULATCH |= (data >> 3);
+
+    }
+    ppux->flipflop = !(ppux->flipflop);
+}
+
+
+static void
+ppuaddr_write (cpu_inst* cpux, word address, byte data)
+{
+    ppu_inst* ppux = ppu_io_write (cpux, data);
+
+    // (writes are two operations)
+    if (ppux->flipflop) {
+        // 2nd write is lower byte
+        ppux->PPULATCH |= data;
+        ppux->PPUADDR = ppux->PPULATCH;
+        ppux->SCROLL = ppux->PPULATCH;  // not sure about this
+
+        // (the new address goes out on the PPU bus)
+        if (ppux->a12_exact) {
+            ppu_a12 (ppux, ppux->PPUADDR & 0x1000);
         }
+    } else {
+        // 1st write is upper byte
+        ppux->PPULATCH = (data << 8);
+    }
+    ppux->flipflop = !(ppux->flipflop);
+}
+
+
+static void
+ppudata_write (cpu_inst* cpux, word address, byte data)
+{
+    ppu_inst* ppux = ppu_io_write (cpux, data);
+
+    ppux->PPUDATA = data;
+
+    // Protect CHR-ROM from writes (CHR-RAM is fair game)
+    if (((ppux->PPUADDR & 0x3FFF) > 0x2000) ||
+        !cpux->rom0->chr_rom_size) {
+        *ppu_byte (ppux, ppux->PPUADDR) = ppux->PPUDATA;
     }
 
-    // Expansions ROM, SRAM
-    else if ((address >= 0x4000) && (address < 0x8000)) {
-        return *mmap[address];
+    if ((ppux->PPUCTRL & 0x04)) {
+        ppux->PPUADDR += 32;
+    } else {
+        ppux->PPUADDR++;
     }
+}
 
-    // PRG-ROM
-    else {
-        return *mmap[address];
+
+// Sprite OAM DMA
+static void
+oamdma_write (cpu_inst* cpux, word address, byte data)
+{
+    MMAP_BYTE (cpux->mmap, address) = data;
+
+    // The PPU will take over and perform the DMA.  During this time
+    // the PPU will continue to render (and the APU /should/ continue
+    // to play sound), but the CPU will be cycle-stolen until the DMA
+    // transfer is complete. Effectively, the CPU is "frozen in time"
+    // during the DMA.
+    PPU_SYNC (cpux->ppux);
+    do_dma (cpux);
+}
+
+
+// $4000-$401F: APU, OAMDMA, joypads (all plain memory for now)
+//
+// (the tables are not static: read_mem & write_mem are extern
+//  inline, and may only reference objects with external linkage)
+#define APU_READ        io_mmap_read
+#define APU_WRITE       io_mmap_write
+
+const io_reader io_read[IO_REGS] = {
+    io_none_read,       // PPUCTRL
+    io_none_read,       // PPUMASK
+    ppustatus_read,     // PPUSTATUS
+    io_none_read,       // OAMADDR
+    io_none_read,       // OAMDATA  (only Micromachines reads this?)
+    io_none_read,       // PPUSCROLL
+    io_none_read,       // PPUADDR
+    ppudata_read,       // PPUDATA
+
+    APU_READ,  APU_READ,  APU_READ,  APU_READ,      // $4000
+    APU_READ,  APU_READ,  APU_READ,  APU_READ,      // $4004
+    APU_READ,  APU_READ,  APU_READ,  APU_READ,      // $4008
+    APU_READ,  APU_READ,  APU_READ,  APU_READ,      // $400C
+    APU_READ,  APU_READ,  APU_READ,  APU_READ,      // $4010
+    APU_READ,  APU_READ,  APU_READ,  APU_READ,      // $4014
+    APU_READ,  APU_READ,  APU_READ,  APU_READ,      // $4018
+    APU_READ,  APU_READ,  APU_READ,  APU_READ       // $401C
+};
+
+const io_writer io_write[IO_REGS] = {
+    ppuctrl_write,      // PPUCTRL
+    ppumask_write,      // PPUMASK
+    ppustatus_write,    // PPUSTATUS
+    oamaddr_write,      // OAMADDR
+    oamdata_write,      // OAMDATA
+    ppuscroll_write,    // PPUSCROLL
+    ppuaddr_write,      // PPUADDR
+    ppudata_write,      // PPUDATA
+
+    APU_WRITE, APU_WRITE, APU_WRITE, APU_WRITE,     // $4000
+    APU_WRITE, APU_WRITE, APU_WRITE, APU_WRITE,     // $4004
+    APU_WRITE, APU_WRITE, APU_WRITE, APU_WRITE,     // $4008
+    APU_WRITE, APU_WRITE, APU_WRITE, APU_WRITE,     // $400C
+    APU_WRITE, APU_WRITE, APU_WRITE, APU_WRITE,     // $4010
+    oamdma_write,                                   // $4014 OAMDMA
+               APU_WRITE, APU_WRITE, APU_WRITE,
+    APU_WRITE, APU_WRITE, APU_WRITE, APU_WRITE,     // $4018
+    APU_WRITE, APU_WRITE, APU_WRITE, APU_WRITE      // $401C
+};
+
+#undef APU_READ
+#undef APU_WRITE
+
+
+// Provides an abstraction for reading from memory
+inline byte
+read_mem (word address, cpu_inst* cpux)
+{
+    PPU_STEP (cpux->ppux, 3);
+
+    // RAM, Stack, Zero Page, Expansion ROM, SRAM, PRG-ROM
+    if ((address < 0x2000) || (address >= 0x4020)) {
+        return MMAP_BYTE (cpux->mmap, address);
     }
+
+    // I/O Registers
+    return io_read[IO_REG (address)] (cpux, address);
 }
 
 
@@ -349,131 +1640,44 @@ read_mem (word address, cpu_inst* cpux)
 inline void
 write_mem (byte data, word address, cpu_inst* cpux)
 {
-    int i;
-    byte** mmap = cpux->mmap;
-    ppu_inst* ppux = cpux->ppux;
-
-    run_ppu (ppux, 3);
+    PPU_STEP (cpux->ppux, 3);
 
     // RAM, Stack, Zero Page
     if (address < 0x2000) {
-        *mmap[address] = data;
-    }
-
-    // I/O Block Writes
-    else if ((address >= 0x2000) && (address < 0x4000)) {
-
-        // Last write to PPU I/O is held in PPUSTATUS
-        ppux->PPUSTATUS |= (0x1F & data);
-
-        // Because the I/O register map is highly mirrored 
-        switch (address % 8)
-        {
-        // PPUCTRL
-        case 0x00:
-            ppux->PPUCTRL = data;
-
-            // Lower 2 bits into B11-B10 of latch
-            ppux->PPULATCH |= (0x03 & data) << 10;
-            break;
-
-        // PPUMASK
-        case 0x01:
-            ppux->PPUMASK = data;
-            break;
-
-        // PPUSTATUS
-        case 0x02:
-            // (cannot be written)
-            break;
-
-        // OAMADDR
-        case 0x03:
-            ppux->OAMADDR = data;
-            break;
-
-        // OAMDATA
-        case 0x04:
-            // (writes cause OAMADDR to increment)
-            ppux->OAMDATA = data;
-            ppux->OAM[ppux->OAMADDR++] = ppux->OAMDATA;
-            break;
-
-        // PPUSCROLL
-        case 0x05:
-            // (writes are two operations)
-            if (ppux->flipflop) {
-                // (2nd write - Vertical Scroll Offset)
-                /* Lower 3 bits into B14-B12 of latch */
-                ppux->PPULATCH |= (0x07 & data) << 12;
-                /* Upper 5 bits into B9-B5 of latch */
-                ppux->PPULATCH |= (data >> 3) << 5;
-            } else {
-                // (1st write - Horizontal Scroll Offset)
-                /* Lower 3 bits define fine scroll */
-                ppux->FINESCROLL = (0x07 & data);
-                /* Upper 5 bits into B4-B0 of latch  */
-                ppux->PPULATCH |= (data >> 3);
-
-            }
-            ppux->flipflop = !(ppux->flipflop);
-            break;
-
-        // PPUADDR
-        case 0x06:
-            // (writes are two operations)
-            if (ppux->flipflop) {
-                // 2nd write is lower byte
-                ppux->PPULATCH |= data;
-                ppux->PPUADDR = ppux->PPULATCH;
-                ppux->SCROLL = ppux->PPULATCH;  // not sure about this
-            } else {
-                // 1st write is upper byte
-                ppux->PPULATCH = (data << 8);
-            }
-            ppux->flipflop = !(ppux->flipflop);
-            break;
-
-        // PPUDATA
-        case 0x07:
-            ppux->PPUDATA = data;
-
-            // Protect CHR-ROM from writes
-            if (ppux->PPUADDR > 0x2000) {
-                *ppux->mmap[ppux->PPUADDR] = ppux->PPUDATA;
-            }
-
-            if ((ppux->PPUCTRL & 0x04)) {
-                ppux->PPUADDR += 32;
-            } else {
-                ppux->PPUADDR++;
-            }
-            break;
-        }
+        MMAP_BYTE (cpux->mmap, address) = data;
     }
 
-    // Expansions ROM, SRAM
-    else if ((address >= 0x4000) && (address < 0x8000)) {
-        *mmap[address] = data;
+    // I/O Registers
+    else if (address < 0x4020) {
+        io_write[IO_REG (address)] (cpux, address, data);
+    }
 
-        // Sprite OAM DMA
-        if (address == 0x4014) {
-            // The PPU will take over and perform the DMA.  During this time
-            // the PPU will continue to render (and the APU /should/ continue
-            // to play sound), but the CPU will be cycle-stolen until the DMA
-            // transfer is complete. Effectively, the CPU is "frozen in time"
-            // during the DMA.
-            do_dma (cpux);
+    // Expansions ROM
+    else if (address < 0x6000) {
+        MMAP_BYTE (cpux->mmap, address) = data;
+    }
+
+    // SRAM (a disabled chip ignores writes: the pages are open bus)
+    else if (address < 0x8000) {
+        if (cpux->sram_enabled) {
+            MMAP_BYTE (cpux->mmap, address) = data;
+
+            // Battery SRAM gets flushed to disk later (see sram.c,
+            // whose thread clears the flag)
+            __atomic_store_n (&cpux->sram_dirty, 1, __ATOMIC_RELEASE);
         }
     }
 
     // PRG-ROM
     else {
         // The CPU will *write* to this PRG-ROM region 0x8000-0xFFFF when
-        // communicating with certain Memory Mapper hardware.  So, we save
-        // these writes to a shadow buffer instead of PRG-ROM.  To do this, we
-        // extend the memory map by 32KB (32768 bytes).
-        *mmap[address + 0x8000] = data;
+        // communicating with certain Memory Mapper hardware.  Mappers
+        // that listen decode the write right here (boards without
+        // registers have no write hook, and the write goes nowhere).
+        if (cpux->mapper->write) {
+            PPU_SYNC (cpux->ppux);
+            cpux->mapper->write (cpux, address, data);
+        }
     }
 }
 
@@ -481,12 +1685,12 @@ write_mem (byte data, word address, cpu_inst* cpux)
 inline byte
 read_mem_generic (word address, byte **mmap)
 {
-    return *mmap[address];
+    return MMAP_BYTE (mmap, address);
 }
 
 
 inline void
 write_mem_generic (byte data, word address, byte **mmap)
 {
-    *mmap[address] = data;
+    MMAP_BYTE (mmap, address) = data;
 }
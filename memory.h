@@ -24,6 +24,67 @@
 #include "6502_types.h"
 #include "romreader.h"
 
+// All of the mutable memory of one NES instance.  ROM is not in
+// here: it is shared, read-only, by every instance running it.
+struct nes_memory_struct {
+    byte RAM[2048];         /* CPU RAM                        */
+    byte SRAM[8192];        /* CPU Save RAM                   */
+    byte EXP[8192];         /* I/O & Expansion area           */
+    byte TABLES[4096];      /* PPU Name/Attribute Tables      */
+    byte PALETTES[32];      /* PPU Palettes                   */
+    byte OAM[256];          /* Sprite RAM (OAM)               */
+    byte CHR_RAM[8192];     /* (boards without CHR-ROM)       */
+    byte OPENBUS[MMAP_PAGE_SIZE];   /* backs unmapped pages   */
+};
+
+// Instance arena
+//
+// make_instance puts everything mutable about one NES in a single
+// cache line aligned block, so copying an instance is one memcpy
+// (plus pointer fixups) and destroying it is one free:
+//
+//   ARENA_CPU   cpu_inst    registers & LUT pointers in the first
+//                           cache line, then the CPU page table
+//   ARENA_PPU   ppu_inst    page table, registers & scanline state
+//   ARENA_MEM   nes_memory  RAM, SRAM, EXP, tables, palettes, OAM,
+//                           CHR-RAM & the open bus page
+//
+// Each part starts on an ARENA_ALIGN boundary.  The cpu_inst is at
+// offset 0, so an instance's cpu_inst* is also the arena's address.
+#define ARENA_ALIGN     64
+#define ARENA_ROUND(n)  (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_CPU       0
+#define ARENA_PPU       ARENA_ROUND (ARENA_CPU + sizeof(cpu_inst))
+#define ARENA_MEM       ARENA_ROUND (ARENA_PPU + sizeof(ppu_inst))
+#define ARENA_SIZE      ARENA_ROUND (ARENA_MEM + sizeof(nes_memory))
+
+// A memory mapper (cartridge board).  Only init is required;
+// every other hook may be 0 if the board has no use for it.
+struct mapper_descriptor {
+    int id;                 /* iNES mapper #                       */
+
+    /* Power-on: map the banks & reset mapper_regs state */
+    void (*init)(cpu_inst* cpux);
+
+    /* CPU write to $8000-$FFFF (register decode) */
+    void (*write)(cpu_inst* cpux, word address, byte data);
+
+    /* PPU A12 rose (only while ppux->a12_exact is set) */
+    void (*a12)(cpu_inst* cpux);
+
+    /* PPU fetched the pattern of tile $FD or $FE; address is that
+     * of its 2nd bit plane (only while ppux->chr_latch is set) */
+    void (*latch)(cpu_inst* cpux, word address);
+
+    /* PPUCTRL or PPUMASK was written */
+    void (*ppu_config)(cpu_inst* cpux);
+
+    /* Save states: save runs before mapper_regs are stored, load
+     * after they are restored (and re-maps the banks from them) */
+    void (*save)(cpu_inst* cpux);
+    void (*load)(cpu_inst* cpux);
+};
+
 #if defined __cplusplus
 extern "C" {
 #endif
@@ -32,6 +93,46 @@ extern "C" {
 //void init_memorymap (cpu_inst* cpux);
 void init_nes_memorymap (cpu_inst* cpux, ppu_inst* ppux);
 
+/* Frees what init_nes_memorymap allocated */
+void destroy_nes_memorymap (cpu_inst* cpux);
+
+/* Looks a mapper up in the registry (0 if not supported) */
+const mapper_desc* find_mapper (int id);
+
+/* Attaches rom & its mapper to an instance and runs the mapper's
+ * init.  Returns -1 (and attaches nothing) if the mapper is not
+ * supported. */
+int attach_rom (cpu_inst* cpux, nes_rom* rom);
+
+/* Allocates an instance arena holding a power-on CPU, PPU & memory
+ * map (the caller still attaches the ROM & runs the mapper init) */
+cpu_inst* make_instance (cpu_luts* luts);
+
+/* Power cycles an instance in place: registers, RAM & banks go back
+ * to their power-on state, then the mapper init & a CPU reset run
+ * for the attached ROM.  Display & battery SRAM are kept. */
+void reset_instance (cpu_inst* cpux);
+
+/* Overwrites dst with the complete state of src.  dst keeps its
+ * display and its battery SRAM backing (which gets src's data). */
+void copy_instance (cpu_inst* dst, cpu_inst* src);
+
+/* Copies a running instance (CPU + PPU + mapper + memory).  ROM,
+ * LUTs & mapper table are shared with src; the clone is headless
+ * and may run on its own thread. */
+cpu_inst* clone_instance (cpu_inst* src);
+
+/* Frees an instance from make_instance or clone_instance */
+void destroy_instance (cpu_inst* cpux);
+
+/* Switches name table mirroring (MIRROR_xxx): 4 page writes */
+void set_mirroring (ppu_inst* ppux, int mode);
+
+/* Points a range of the memory map at a block of memory */
+void swap_in (byte **dest, unsigned int base_addr_dest,
+              byte *src, unsigned int base_addr_src,
+              unsigned int page_size);
+
 /* Read a byte from memory (CPU) */
 inline byte read_mem (word address, cpu_inst* cpux);
 
@@ -0,0 +1,149 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Builds a binary ROM database (see romdb.h) from a text listing.
+// One ROM per line:
+//
+//   <crc32> <sha1> [mapper=N] [mirroring=N] [prgram=N] [battery=N] [tv=N]
+//
+// with hashes in hex and '#' starting a comment.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "romdb.h"
+
+static int
+parse_line (char *line, romdb_entry *entry)
+{
+    char *tok;
+    char *val;
+    unsigned int crc;
+    unsigned int b;
+    int i;
+
+    memset (entry, 0, sizeof(romdb_entry));
+
+    if ((tok = strchr (line, '#'))) {
+        *tok = '\0';
+    }
+
+    // crc32
+    if (!(tok = strtok (line, " \t\r\n"))) {
+        return 0;   // blank
+    }
+    if (sscanf (tok, "%x", &crc) != 1) {
+        return -1;
+    }
+    entry->crc32 = crc;
+
+    // sha1
+    if (!(tok = strtok (0, " \t\r\n")) || strlen (tok) != 40) {
+        return -1;
+    }
+    for (i=0; i<20; i++) {
+        if (sscanf (tok + 2*i, "%2x", &b) != 1) {
+            return -1;
+        }
+        entry->sha1[i] = b;
+    }
+
+    // corrections
+    while ((tok = strtok (0, " \t\r\n"))) {
+        if (!(val = strchr (tok, '='))) {
+            return -1;
+        }
+        *val++ = '\0';
+        b = atoi (val);
+
+        if (!strcmp (tok, "mapper")) {
+            if (b > 255) {
+                return -1;
+            }
+            entry->fix |= ROMDB_MAPPER;
+            entry->mapper = b;
+        } else if (!strcmp (tok, "mirroring")) {
+            if (b > MIRROR_SINGLE_B) {
+                return -1;
+            }
+            entry->fix |= ROMDB_MIRRORING;
+            entry->mirroring = b;
+        } else if (!strcmp (tok, "prgram")) {
+            entry->fix |= ROMDB_PRGRAM;
+            entry->prg_ram_size = b;
+        } else if (!strcmp (tok, "battery")) {
+            entry->fix |= ROMDB_BATTERY;
+            entry->battery = b;
+        } else if (!strcmp (tok, "tv")) {
+            entry->fix |= ROMDB_TV;
+            entry->tv = b;
+        } else {
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+int
+main (int argc, char* argv[])
+{
+    FILE *fp;
+    char line[512];
+    romdb_entry *entries = 0;
+    unsigned int count = 0;
+    unsigned int alloc = 0;
+    int lineno = 0;
+    int rc;
+
+    if (argc != 3) {
+        printf ("Usage: retrobox-mkdb listing.txt romdb.bin\n\n");
+        exit (0);
+    }
+
+    if (!(fp = fopen (argv[1], "r"))) {
+        printf ("Unable to open %s\n\n", argv[1]);
+        exit (1);
+    }
+
+    while (fgets (line, sizeof(line), fp)) {
+        lineno++;
+
+        if (count == alloc) {
+            alloc = alloc ? 2*alloc : 1024;
+            entries = (romdb_entry*) realloc (entries, alloc * sizeof(romdb_entry));
+        }
+
+        rc = parse_line (line, &entries[count]);
+        if (rc < 0) {
+            fprintf (stderr, "%s:%i: parse error\n", argv[1], lineno);
+            exit (1);
+        }
+        count += rc;
+    }
+    fclose (fp);
+
+    if (write_romdb (argv[2], entries, count)) {
+        fprintf (stderr, "Unable to write %s\n", argv[2]);
+        exit (1);
+    }
+
+    printf ("Wrote %u entries to %s\n", count, argv[2]);
+    free (entries);
+
+    return 0;
+}
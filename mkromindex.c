@@ -0,0 +1,277 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// retrobox-index: walks a directory tree for .nes files and writes
+// a ROM corpus index (see romindex.h).  The tree walk only collects
+// paths; reading, header parsing and hashing are spread over a pool
+// of worker threads that claim files in batches.
+
+#define _XOPEN_SOURCE 500     /* nftw() */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "romindex.h"
+#include "romreader.h"
+#include "timer.h"
+
+/* Files a worker claims per trip to the lock */
+#define INDEX_BATCH 32
+
+typedef struct index_job_struct index_job;
+struct index_job_struct {
+    char *paths;            // path table (NUL terminated strings)
+    unsigned int paths_size;
+    unsigned int paths_alloc;
+
+    romindex_entry *entries;
+    unsigned int count;
+    unsigned int alloc;
+
+    /* Work distribution */
+    pthread_mutex_t lock;
+    unsigned int next;      // next unclaimed entry
+};
+
+// nftw() has no user pointer
+static index_job job;
+
+
+static int
+is_nes_file (const char *path)
+{
+    size_t len = strlen (path);
+    return (len > 4) && !strcasecmp (path + len - 4, ".nes");
+}
+
+// Tree walk callback: just records the path of each .nes file
+static int
+add_file (const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    size_t len;
+
+    if (type != FTW_F || !is_nes_file (path)) {
+        return 0;
+    }
+
+    len = strlen (path) + 1;
+    while (job.paths_size + len > job.paths_alloc) {
+        job.paths_alloc = job.paths_alloc ? 2*job.paths_alloc : 1024*1024;
+        job.paths = (char*) realloc (job.paths, job.paths_alloc);
+    }
+    if (job.count == job.alloc) {
+        job.alloc = job.alloc ? 2*job.alloc : 4096;
+        job.entries = (romindex_entry*) realloc (job.entries, job.alloc * sizeof(romindex_entry));
+    }
+
+    memset (&job.entries[job.count], 0, sizeof(romindex_entry));
+    job.entries[job.count].path = job.paths_size;
+    job.count++;
+
+    memcpy (job.paths + job.paths_size, path, len);
+    job.paths_size += len;
+
+    return 0;
+}
+
+// Reads, parses & hashes one file.  The file is read into a per
+// worker buffer rather than mmap()ed: corpus ROMs are small, and
+// tens of thousands of map/unmap pairs from many threads would
+// mostly contend on the address space lock.
+static void
+index_file (romindex_entry *entry, byte **buf, unsigned int *buf_size)
+{
+    const char *path = job.paths + entry->path;
+    struct stat st;
+    nes_rom rom;
+    ssize_t n;
+    unsigned int got;
+    int fd;
+
+    entry->status = ROMINDEX_IO_ERROR;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat (fd, &st) < 0) {
+        close (fd);
+        return;
+    }
+    entry->file_size = (uint32_t) st.st_size;
+
+    if (entry->file_size > *buf_size) {
+        *buf_size = entry->file_size;
+        *buf = (byte*) realloc (*buf, *buf_size);
+    }
+    for (got=0; got<entry->file_size; got+=n) {
+        n = read (fd, *buf + got, entry->file_size - got);
+        if (n <= 0) {
+            close (fd);
+            return;
+        }
+    }
+    close (fd);
+
+    // Same header parser the emulator uses
+    memset (&rom, 0, sizeof(nes_rom));
+    entry->status = read_ines (&rom, *buf, entry->file_size);
+    if (entry->status != ROM_OK) {
+        return;
+    }
+
+    hash_rom (&rom);
+
+    entry->crc32 = rom.crc32;
+    memcpy (entry->sha1, rom.sha1, 20);
+    entry->mapper       = rom.mapper;
+    entry->prg_rom_size = rom.prg_rom_size;
+    entry->chr_rom_size = rom.chr_rom_size;
+    entry->prg_ram_size = rom.prg_ram_size;
+    entry->mirroring    = rom.flg_mirroring;
+    entry->tv           = rom.flg_tv;
+    entry->flags = (rom.flg_sram        ? ROMINDEX_BATTERY    : 0)
+                 | (rom.flg_trainer     ? ROMINDEX_TRAINER    : 0)
+                 | (rom.flg_vsunisystem ? ROMINDEX_VS         : 0)
+                 | (rom.flg_playchoice  ? ROMINDEX_PLAYCHOICE : 0)
+                 | (rom.flg_nes20       ? ROMINDEX_NES20      : 0);
+}
+
+static void*
+index_worker (void *arg)
+{
+    byte *buf = 0;
+    unsigned int buf_size = 0;
+    unsigned int i, end;
+
+    for (;;) {
+        pthread_mutex_lock (&job.lock);
+        i = job.next;
+        end = (i + INDEX_BATCH < job.count) ? i + INDEX_BATCH : job.count;
+        job.next = end;
+        pthread_mutex_unlock (&job.lock);
+
+        if (i == end) {
+            break;
+        }
+        for (; i<end; i++) {
+            index_file (&job.entries[i], &buf, &buf_size);
+        }
+    }
+
+    free (buf);
+    return 0;
+}
+
+static void
+print_summary (double secs)
+{
+    unsigned int mappers[256];
+    unsigned int tv[2] = {0, 0};
+    unsigned int bad = 0;
+    unsigned int i;
+
+    memset (mappers, 0, sizeof(mappers));
+    for (i=0; i<job.count; i++) {
+        if (job.entries[i].status != ROM_OK) {
+            bad++;
+            continue;
+        }
+        mappers[job.entries[i].mapper]++;
+        tv[job.entries[i].tv]++;
+    }
+
+    printf ("Indexed %u files in %.2f s (%u unreadable or bad)\n\n", job.count, secs, bad);
+    printf ("  NTSC: %u\n", tv[0]);
+    printf ("   PAL: %u\n\n", tv[1]);
+    for (i=0; i<256; i++) {
+        if (mappers[i]) {
+            printf ("  %7u  mapper %3u (%s)\n", mappers[i], i, mapper_name (i));
+        }
+    }
+    printf ("\n");
+}
+
+static void
+print_usage ()
+{
+    printf ("Usage: retrobox-index [-j threads] directory index.bin\n\n");
+}
+
+
+int
+main (int argc, char* argv[])
+{
+    pthread_t *threads;
+    int nthreads;
+    int64_t start;
+    int i;
+
+    nthreads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+
+    i = 1;
+    if (argc > 2 && !strcmp (argv[1], "-j")) {
+        nthreads = atoi (argv[2]);
+        i = 3;
+    }
+    if (argc - i != 2) {
+        print_usage ();
+        exit (0);
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+
+    start = timer_ns ();
+
+    // Collect paths (directory reads are cheap next to file contents)
+    memset (&job, 0, sizeof(index_job));
+    if (nftw (argv[i], add_file, 64, FTW_PHYS) < 0) {
+        fprintf (stderr, "Unable to walk %s\n", argv[i]);
+        exit (1);
+    }
+
+    pthread_mutex_init (&job.lock, 0);
+    threads = (pthread_t*) malloc (nthreads * sizeof(pthread_t));
+    for (i=0; i<nthreads; i++) {
+        pthread_create (&threads[i], 0, index_worker, 0);
+    }
+    for (i=0; i<nthreads; i++) {
+        pthread_join (threads[i], 0);
+    }
+    free (threads);
+    pthread_mutex_destroy (&job.lock);
+
+    if (write_romindex (argv[argc-1], job.entries, job.count, job.paths, job.paths_size)) {
+        fprintf (stderr, "Unable to write %s\n", argv[argc-1]);
+        exit (1);
+    }
+
+    print_summary ((timer_ns () - start) / 1e9);
+
+    free (job.entries);
+    free (job.paths);
+
+    return 0;
+}
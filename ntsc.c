@@ -0,0 +1,419 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// NTSC composite video filter.
+//
+// The 2C02 does not output RGB.  It generates a composite square
+// wave at 8 samples per pixel whose phase against the 3.58 MHz
+// color subcarrier (12 samples per cycle) encodes hue.  The TV then
+// separates luma and chroma with low-pass filters, which is where
+// the color fringing and blending artifacts come from.
+//
+// Because the whole decode (box-filter luma, quadrature demodulate
+// chroma, YIQ -> RGB) is linear, the decoded output of a scanline is
+// just the sum of the decoded outputs of each pixel taken alone.  So
+// at start-up we decode every (burst phase, position, 9-bit color)
+// once into a small kernel of output pixels, and at run-time each
+// input pixel costs NTSC_TAPS vector adds.  Scanlines are independent,
+// so frames are split into bands across worker threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "ntsc.h"
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SAMPLES_PER_PIXEL   8
+#define SAMPLES_PER_CYCLE   12
+#define GROUP_SAMPLES       (NTSC_IN_GROUP * SAMPLES_PER_PIXEL)
+
+// First output tap of a group's kernels, relative to the group's
+// first output pixel (the decode window reaches back 3 pixels)
+#define TAP_OFFSET          3
+
+// Decoder low-pass windows, in samples
+#define LUMA_WINDOW         12.0
+#define CHROMA_WINDOW       24.0
+
+// Hue tweak (in samples) aligning the decoder with the color burst
+#define HUE                 3.9
+
+// 8 fractional bits in the kernels & accumulators
+#define FIX_SHIFT           8
+#define FIX_ONE             (255 << FIX_SHIFT)
+
+// Index into the kernel table
+#define KERNEL(ntscx,burst,k,color) \
+    ((ntscx)->kernel + 4*NTSC_TAPS*((((burst)*NTSC_IN_GROUP + (k)) * NTSC_COLORS) + (color)))
+
+// Accumulator row length (in 4-lane entries)
+#define ACC_WIDTH           (NTSC_OUT_WIDTH + NTSC_TAPS)
+
+// Composite signal level of one sample, normalized so
+// black = 0.0 and white = 1.0
+static double
+composite_level (int pixel, int phase)
+{
+    // Voltage levels relative to sync
+    static const double levels[8] = {
+        0.350, 0.518, 0.962, 1.550,     // signal low
+        1.094, 1.506, 1.962, 1.962      // signal high
+    };
+    const double black = 0.518;
+    const double white = 1.962;
+    const double attenuation = 0.746;
+
+    int color    = (pixel & 0x0F);
+    int level    = (pixel >> 4) & 0x03;
+    int emphasis = (pixel >> 6) & 0x07;
+    double low, high, signal;
+
+    // Colors $xE/$xF are always black ($1D level)
+    if (color > 13) {
+        level = 1;
+    }
+
+    low  = levels[0 + level];
+    high = levels[4 + level];
+    if (color == 0) {
+        low = high;      // greys: no chroma, high level only
+    }
+    if (color > 12) {
+        high = low;      // blacks: low level only
+    }
+
+#define IN_PHASE(c) ((((c) + phase) % SAMPLES_PER_CYCLE) < 6)
+
+    signal = IN_PHASE (color) ? high : low;
+
+    // Emphasis bits attenuate the signal during their third of the cycle
+    if (((emphasis & 1) && IN_PHASE (0)) ||
+        ((emphasis & 2) && IN_PHASE (4)) ||
+        ((emphasis & 4) && IN_PHASE (8))) {
+        signal *= attenuation;
+    }
+
+#undef IN_PHASE
+
+    return (signal - black) / (white - black);
+}
+
+// Length of [a0,a1) & [b0,b1) overlap
+static double
+overlap (double a0, double a1, double b0, double b1)
+{
+    double lo = (a0 > b0) ? a0 : b0;
+    double hi = (a1 < b1) ? a1 : b1;
+    return (hi > lo) ? (hi - lo) : 0.0;
+}
+
+// Decodes a single pixel (at position k of a 3 pixel group,
+// everything else black) into its NTSC_TAPS output pixels.
+static void
+build_kernel (int32_t *kern, int burst, int k, int color, int lane[3])
+{
+    int t, n, c;
+    double center, s, wy, wc, ph;
+    double y, i, q, rgb[3];
+
+    for (t=0; t<NTSC_TAPS; t++) {
+        // Center of this output pixel, in samples from group start
+        center = ((t - TAP_OFFSET) + 0.5) * GROUP_SAMPLES / (double) NTSC_OUT_GROUP;
+
+        y = i = q = 0.0;
+        for (n = k*SAMPLES_PER_PIXEL; n < (k+1)*SAMPLES_PER_PIXEL; n++) {
+            ph = (n + 4*burst) % SAMPLES_PER_CYCLE;
+            s = composite_level (color, (int) ph);
+
+            wy = overlap (n, n+1, center - LUMA_WINDOW/2, center + LUMA_WINDOW/2) / LUMA_WINDOW;
+            wc = overlap (n, n+1, center - CHROMA_WINDOW/2, center + CHROMA_WINDOW/2) / CHROMA_WINDOW;
+
+            y += s * wy;
+            i += s * wc * cos (M_PI * (ph + HUE) / 6.0);
+            q += s * wc * sin (M_PI * (ph + HUE) / 6.0);
+        }
+
+        // Quadrature demodulation halves the amplitude; undo that
+        i *= 2.0;
+        q *= 2.0;
+
+        // FCC YIQ -> RGB
+        rgb[0] = y + 0.946882*i + 0.623557*q;
+        rgb[1] = y - 0.274788*i - 0.635691*q;
+        rgb[2] = y - 1.108545*i + 1.709007*q;
+
+        kern[4*t + 0] = 0;
+        kern[4*t + 1] = 0;
+        kern[4*t + 2] = 0;
+        kern[4*t + 3] = 0;
+        for (c=0; c<3; c++) {
+            kern[4*t + lane[c]] = (int32_t) floor (rgb[c] * FIX_ONE + 0.5);
+        }
+    }
+}
+
+// Filters one NES scanline into one destination line
+static void
+filter_line (ntsc_inst* ntscx, const unsigned int *in, uint32_t *out, int burst)
+{
+    int g, k, t, x, o;
+    const int32_t *kern;
+
+#if defined (__SSE2__)
+    __m128i acc[ACC_WIDTH];
+    __m128i *a;
+    __m128i v0, v1, v2, v3;
+
+    for (o=0; o<ACC_WIDTH; o++) {
+        acc[o] = _mm_setzero_si128 ();
+    }
+
+    for (g=0; g<NTSC_GROUPS; g++) {
+        for (k=0; k<NTSC_IN_GROUP; k++) {
+            x = g*NTSC_IN_GROUP + k - 1;
+            if ((x < 0) || (x >= 256)) {
+                continue;   // black padding contributes nothing
+            }
+            kern = KERNEL (ntscx, burst, k, in[x] & (NTSC_COLORS - 1));
+            a = acc + g*NTSC_OUT_GROUP;
+            for (t=0; t<NTSC_TAPS; t++) {
+                a[t] = _mm_add_epi32 (a[t], _mm_loadu_si128 ((const __m128i*) (kern + 4*t)));
+            }
+        }
+    }
+
+    // Scale, saturate to 0..255 and pack 4 output pixels at a time
+    for (o=0; o<NTSC_OUT_WIDTH; o+=4) {
+        v0 = _mm_srai_epi32 (acc[o + TAP_OFFSET + 0], FIX_SHIFT);
+        v1 = _mm_srai_epi32 (acc[o + TAP_OFFSET + 1], FIX_SHIFT);
+        v2 = _mm_srai_epi32 (acc[o + TAP_OFFSET + 2], FIX_SHIFT);
+        v3 = _mm_srai_epi32 (acc[o + TAP_OFFSET + 3], FIX_SHIFT);
+        v0 = _mm_packs_epi32 (v0, v1);
+        v2 = _mm_packs_epi32 (v2, v3);
+        v0 = _mm_packus_epi16 (v0, v2);
+        if (o + 4 <= NTSC_OUT_WIDTH) {
+            _mm_storeu_si128 ((__m128i*) (out + o), v0);
+        } else {
+            uint32_t tmp[4];
+            _mm_storeu_si128 ((__m128i*) tmp, v0);
+            memcpy (out + o, tmp, (NTSC_OUT_WIDTH - o) * sizeof(uint32_t));
+        }
+    }
+#else
+    int32_t acc[4*ACC_WIDTH];
+    int32_t *a;
+    int v, l;
+    uint32_t px;
+
+    memset (acc, 0, sizeof(acc));
+
+    for (g=0; g<NTSC_GROUPS; g++) {
+        for (k=0; k<NTSC_IN_GROUP; k++) {
+            x = g*NTSC_IN_GROUP + k - 1;
+            if ((x < 0) || (x >= 256)) {
+                continue;
+            }
+            kern = KERNEL (ntscx, burst, k, in[x] & (NTSC_COLORS - 1));
+            a = acc + 4*g*NTSC_OUT_GROUP;
+            for (t=0; t<4*NTSC_TAPS; t++) {
+                a[t] += kern[t];
+            }
+        }
+    }
+
+    for (o=0; o<NTSC_OUT_WIDTH; o++) {
+        a = acc + 4*(o + TAP_OFFSET);
+        px = 0;
+        for (l=0; l<4; l++) {
+            v = a[l] >> FIX_SHIFT;
+            v = (v < 0) ? 0 : (v > 255) ? 255 : v;
+            px |= (uint32_t) v << (8*l);
+        }
+        out[o] = px;
+    }
+#endif
+}
+
+// Filters scanlines [y0, y1) of the current job
+static void
+filter_band (ntsc_inst* ntscx, int y0, int y1)
+{
+    int y, s;
+    uint32_t *out;
+
+    for (y=y0; y<y1; y++) {
+        out = ntscx->out + (y * ntscx->scale) * ntscx->pitch;
+
+        // Subcarrier phase advances 4 samples (1/3 cycle) per scanline
+        filter_line (ntscx, ntscx->in + 256*y, out, (ntscx->burst + y) % 3);
+
+        for (s=1; s<ntscx->scale; s++) {
+            memcpy (out + s*ntscx->pitch, out, NTSC_OUT_WIDTH * sizeof(uint32_t));
+        }
+    }
+}
+
+static void*
+ntsc_worker (void *arg)
+{
+    ntsc_inst* ntscx = (ntsc_inst*) arg;
+    unsigned int seen;
+    int band;
+
+    // Claim a band (the caller always does band 0)
+    pthread_mutex_lock (&ntscx->lock);
+    band = ++ntscx->bands;
+    pthread_mutex_unlock (&ntscx->lock);
+
+    // (generation starts at 0, so a blit kicked off before we
+    //  got here is still waiting for us)
+    seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock (&ntscx->lock);
+        while ((ntscx->generation == seen) && !ntscx->quit) {
+            pthread_cond_wait (&ntscx->go, &ntscx->lock);
+        }
+        if (ntscx->quit) {
+            pthread_mutex_unlock (&ntscx->lock);
+            break;
+        }
+        seen = ntscx->generation;
+        pthread_mutex_unlock (&ntscx->lock);
+
+        filter_band (ntscx, 240*band / ntscx->threads, 240*(band+1) / ntscx->threads);
+
+        pthread_mutex_lock (&ntscx->lock);
+        if (--ntscx->pending == 0) {
+            pthread_cond_signal (&ntscx->done);
+        }
+        pthread_mutex_unlock (&ntscx->lock);
+    }
+
+    return 0;
+}
+
+// ----------
+
+ntsc_inst*
+make_ntsc (int rshift, int gshift, int bshift, int threads)
+{
+    ntsc_inst *ntscx;
+    int lane[3];
+    int b, k, c, i;
+
+    ntscx = (ntsc_inst*) malloc (sizeof(ntsc_inst));
+    memset (ntscx, 0, sizeof(ntsc_inst));
+
+    // Which 32-bit lane (byte) each channel lands in
+    lane[0] = rshift / 8;
+    lane[1] = gshift / 8;
+    lane[2] = bshift / 8;
+
+    ntscx->kernel = (int32_t*) malloc (3 * NTSC_IN_GROUP * NTSC_COLORS * NTSC_TAPS * 4 * sizeof(int32_t));
+    for (b=0; b<3; b++) {
+        for (k=0; k<NTSC_IN_GROUP; k++) {
+            for (c=0; c<NTSC_COLORS; c++) {
+                build_kernel (KERNEL (ntscx, b, k, c), b, k, c, lane);
+            }
+        }
+    }
+
+    // Thread 0 is the caller
+    if (threads < 1) {
+        threads = 1;
+    }
+    ntscx->threads = threads;
+    if (threads > 1) {
+        pthread_mutex_init (&ntscx->lock, 0);
+        pthread_cond_init (&ntscx->go, 0);
+        pthread_cond_init (&ntscx->done, 0);
+        ntscx->thread = (pthread_t*) malloc (threads * sizeof(pthread_t));
+        ntscx->thread[0] = pthread_self ();
+        for (i=1; i<threads; i++) {
+            pthread_create (&ntscx->thread[i], 0, ntsc_worker, ntscx);
+        }
+    }
+
+    return ntscx;
+}
+
+
+void
+ntsc_blit (ntsc_inst* ntscx, const unsigned int *in, uint32_t *out,
+           int pitch, int scale, int burst)
+{
+    ntscx->in    = in;
+    ntscx->out   = out;
+    ntscx->pitch = pitch;
+    ntscx->scale = scale;
+    ntscx->burst = burst % 3;
+
+    if (ntscx->threads == 1) {
+        filter_band (ntscx, 0, 240);
+        return;
+    }
+
+    // Kick the workers, do our own band, then wait for theirs
+    pthread_mutex_lock (&ntscx->lock);
+    ntscx->pending = ntscx->threads - 1;
+    ntscx->generation++;
+    pthread_cond_broadcast (&ntscx->go);
+    pthread_mutex_unlock (&ntscx->lock);
+
+    filter_band (ntscx, 0, 240 / ntscx->threads);
+
+    pthread_mutex_lock (&ntscx->lock);
+    while (ntscx->pending) {
+        pthread_cond_wait (&ntscx->done, &ntscx->lock);
+    }
+    pthread_mutex_unlock (&ntscx->lock);
+}
+
+
+void
+destroy_ntsc (ntsc_inst* ntscx)
+{
+    int i;
+
+    if (ntscx->threads > 1) {
+        pthread_mutex_lock (&ntscx->lock);
+        ntscx->quit = 1;
+        pthread_cond_broadcast (&ntscx->go);
+        pthread_mutex_unlock (&ntscx->lock);
+
+        for (i=1; i<ntscx->threads; i++) {
+            pthread_join (ntscx->thread[i], 0);
+        }
+        free (ntscx->thread);
+        pthread_cond_destroy (&ntscx->done);
+        pthread_cond_destroy (&ntscx->go);
+        pthread_mutex_destroy (&ntscx->lock);
+    }
+
+    free (ntscx->kernel);
+    free (ntscx);
+}
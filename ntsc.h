@@ -0,0 +1,88 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ntsc_h_
+#define _ntsc_h_
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Every 3 NES pixels (24 composite samples, exactly 2 color
+// subcarrier cycles) are decoded into 7 output pixels.  One
+// black pixel of padding on each side gives 258 = 86*3 inputs.
+#define NTSC_IN_GROUP   3
+#define NTSC_OUT_GROUP  7
+#define NTSC_GROUPS     86
+#define NTSC_OUT_WIDTH  (NTSC_GROUPS * NTSC_OUT_GROUP)     /* 602 */
+
+/* Output pixels touched by one input pixel's decoded signal */
+#define NTSC_TAPS       14
+
+/* 9-bit PPU pixel: 6-bit palette index + 3 emphasis bits */
+#define NTSC_COLORS     512
+
+typedef struct ntsc_instance ntsc_inst;
+struct ntsc_instance {
+
+    /* Pre-decoded kernels: [burst phase][position in group][color][tap]
+     * Each tap is 4 x int32 (fixed point, 8 fractional bits) with
+     * the R, G, B channels already sitting in the lanes that match
+     * the destination pixel format's byte order. */
+    int32_t *kernel;
+
+    /* Worker threads (scanline bands) */
+    int threads;
+    pthread_t *thread;
+    pthread_mutex_t lock;
+    pthread_cond_t go;
+    pthread_cond_t done;
+    unsigned int generation;
+    int bands;              // bands claimed by workers so far
+    int pending;
+    int quit;
+
+    /* Current job */
+    const unsigned int *in;
+    uint32_t *out;
+    int pitch;              // destination pitch (in pixels)
+    int scale;              // 1 or 2 destination lines per NES line
+    int burst;              // color burst phase of line 0 (0..2)
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+    /* Builds the kernels for a 32-bit destination whose R/G/B
+     * channels live at the given bit shifts.  threads > 1 splits
+     * each frame into bands of scanlines. */
+    ntsc_inst* make_ntsc (int rshift, int gshift, int bshift, int threads);
+
+    /* Filters a 256x240 frame of 9-bit pixels into a
+     * NTSC_OUT_WIDTH x (240*scale) 32-bit image */
+    void ntsc_blit (ntsc_inst* ntscx, const unsigned int *in, uint32_t *out,
+                    int pitch, int scale, int burst);
+
+    /* Stops the workers and frees the kernels */
+    void destroy_ntsc (ntsc_inst* ntscx);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
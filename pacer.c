@@ -0,0 +1,199 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pacer.h"
+#include "timer.h"
+
+// Bounds on the busy-wait window in front of each deadline
+#define SPIN_MIN    50000       //  50 us
+#define SPIN_MAX  2000000       //   2 ms
+
+// If we fall this many frames behind, stop trying to catch up
+// and start a fresh schedule from "now" instead.
+#define RESYNC_FRAMES 4
+
+static void
+record_error (pacer_inst* pacerx, int64_t error)
+{
+    int64_t mag = (error < 0) ? -error : error;
+    int bin = (int) (mag / PACER_BIN_NS);
+
+    if (bin >= PACER_BINS) {
+        bin = PACER_BINS - 1;
+    }
+    pacerx->hist[bin]++;
+    pacerx->last_error = error;
+}
+
+// Frameskip policy.  Each missed deadline buys one skipped frame
+// (up to skip_max in a row, so the picture never freezes for long);
+// the first frame back on time ends the run.
+static void
+update_frameskip (pacer_inst* pacerx, int64_t error)
+{
+    int run;
+
+    if (pacerx->skip_next) {
+        pacerx->skipped++;
+        pacerx->skip_run++;
+    }
+
+    if ((error > PACER_MISS_NS) && (pacerx->skip_run < pacerx->skip_max)) {
+        pacerx->skip_next = 1;
+        return;
+    }
+
+    // Run over; account for it
+    if (pacerx->skip_run) {
+        run = (pacerx->skip_run > PACER_MAX_SKIP) ? PACER_MAX_SKIP : pacerx->skip_run;
+        pacerx->skip_runs[run]++;
+    }
+    pacerx->skip_next = 0;
+    pacerx->skip_run = 0;
+}
+
+// ----------
+
+pacer_inst*
+make_pacer (double hz, int throttle)
+{
+    pacer_inst *pacerx = (pacer_inst*) malloc (sizeof(pacer_inst));
+    memset (pacerx, 0, sizeof(pacer_inst));
+
+    pacerx->throttle  = throttle;
+    pacerx->period    = 1.0e9 / hz;
+    pacerx->spin      = 4 * SPIN_MIN;
+    pacerx->oversleep = 2 * SPIN_MIN;
+
+    pacerx->base     = timer_ns ();
+    pacerx->n        = 1;
+    pacerx->deadline = pacerx->base + (int64_t) pacerx->period;
+
+    return pacerx;
+}
+
+
+int64_t
+pace_frame (pacer_inst* pacerx)
+{
+    int64_t now, wake, error;
+
+    pacerx->frames++;
+
+    if (!pacerx->throttle) {
+        update_frameskip (pacerx, 0);
+        return 0;
+    }
+
+    now = timer_ns ();
+
+    // Sleep for the bulk of the wait, if there is one
+    if (pacerx->deadline - now > pacerx->spin) {
+        wake = pacerx->deadline - pacerx->spin;
+        timer_sleep_until (wake);
+        now = timer_ns ();
+
+        // Track how late the OS wakes us, and size the spin
+        // window to cover it with some margin (EWMA, 1/8 gain)
+        pacerx->oversleep += ((now - wake) - pacerx->oversleep) / 8;
+        pacerx->spin = 2 * pacerx->oversleep + SPIN_MIN;
+        if (pacerx->spin > SPIN_MAX) {
+            pacerx->spin = SPIN_MAX;
+        }
+    }
+
+    // ...and spin out the rest
+    while (now < pacerx->deadline) {
+        now = timer_ns ();
+    }
+
+    error = now - pacerx->deadline;
+    if (error > PACER_BIN_NS) {
+        pacerx->late++;
+    }
+    record_error (pacerx, error);
+    update_frameskip (pacerx, error);
+
+    // Schedule the next frame
+    if (error > RESYNC_FRAMES * (int64_t) pacerx->period) {
+        pacerx->base = now;
+        pacerx->n = 0;
+        pacerx->resyncs++;
+    }
+    pacerx->n++;
+    pacerx->deadline = pacerx->base + (int64_t) (pacerx->n * pacerx->period);
+
+    return error;
+}
+
+
+void
+print_pacer_stats (pacer_inst* pacerx)
+{
+    int i;
+    unsigned int peak = 1;
+
+    fprintf (stderr, "Frame pacing: %u frames, %u late, %u resyncs\n",
+             pacerx->frames, pacerx->late, pacerx->resyncs);
+
+    if (pacerx->skip_max) {
+        fprintf (stderr, "  frameskip (max %i): %u frames skipped\n",
+                 pacerx->skip_max, pacerx->skipped);
+        for (i=1; i<=PACER_MAX_SKIP; i++) {
+            if (pacerx->skip_runs[i]) {
+                fprintf (stderr, "    %s%2i in a row: %u times\n",
+                         (i == PACER_MAX_SKIP) ? ">=" : "  ", i, pacerx->skip_runs[i]);
+            }
+        }
+    }
+
+    if (!pacerx->throttle) {
+        fprintf (stderr, "  (throttle off)\n");
+        return;
+    }
+
+    for (i=0; i<PACER_BINS; i++) {
+        if (pacerx->hist[i] > peak) {
+            peak = pacerx->hist[i];
+        }
+    }
+
+    fprintf (stderr, "  |error|          frames\n");
+    for (i=0; i<PACER_BINS; i++) {
+        if (!pacerx->hist[i]) {
+            continue;
+        }
+        if (i == PACER_BINS - 1) {
+            fprintf (stderr, "  >= %4i us    ", i*PACER_BIN_NS/1000);
+        } else {
+            fprintf (stderr, "  %4i-%4i us  ", i*PACER_BIN_NS/1000, (i+1)*PACER_BIN_NS/1000);
+        }
+        fprintf (stderr, "%8u  ", pacerx->hist[i]);
+        fprintf (stderr, "%.*s\n", (int) (40 * (double) pacerx->hist[i] / peak),
+                 "########################################");
+    }
+}
+
+
+void
+destroy_pacer (pacer_inst* pacerx)
+{
+    free (pacerx);
+}
@@ -0,0 +1,90 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _pacer_h_
+#define _pacer_h_
+
+#include <stdint.h>
+
+/* NTSC NES frame rate: 39375000 / 655171 = 60.0988 Hz */
+#define PACER_NTSC_HZ   (39375000.0 / 655171.0)
+
+/* Pacing error histogram: 25us bins, last bin is overflow */
+#define PACER_BIN_NS    25000
+#define PACER_BINS      41
+
+/* A frame later than this counts as a deadline miss for frameskip */
+#define PACER_MISS_NS   1000000
+
+/* Skip runs longer than this are lumped together in the stats */
+#define PACER_MAX_SKIP  10
+
+typedef struct pacer_instance pacer_inst;
+struct pacer_instance {
+
+    int throttle;           // 0 = run flat out (benchmarks)
+
+    /* Schedule.  Deadlines are computed from base + n*period,
+     * never by accumulating, so rounding cannot drift. */
+    double period;          // ns per frame
+    int64_t base;           // time of frame 0 of this schedule
+    int64_t n;              // frames since base
+    int64_t deadline;       // absolute time of the next frame
+
+    /* Hybrid wait: sleep until (deadline - spin), then busy-wait */
+    int64_t spin;           // current spin window (ns)
+    int64_t oversleep;      // smoothed scheduler wake-up latency (ns)
+
+    /* Adaptive frameskip */
+    int skip_max;           // longest allowed run of skipped frames (0 = off)
+    int skip_next;          // decision for the upcoming frame
+    int skip_run;           // frames skipped in a row so far
+
+    /* Statistics */
+    unsigned int frames;    // frames paced
+    unsigned int late;      // frames that missed their deadline
+    unsigned int resyncs;   // schedule resets after falling far behind
+    int64_t last_error;     // wake time - deadline of the last frame (ns)
+    unsigned int hist[PACER_BINS];
+    unsigned int skipped;   // frames emulated but not rendered
+    unsigned int skip_runs[PACER_MAX_SKIP+1];   // # of runs by length
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+    /* Create a frame pacer targeting hz frames per second */
+    pacer_inst* make_pacer (double hz, int throttle);
+
+    /* Blocks until the current frame's deadline and decides
+     * whether the next frame should be skipped (skip_next).
+     * Returns the pacing error in ns (positive = late) */
+    int64_t pace_frame (pacer_inst* pacerx);
+
+    /* Dumps the pacing error histogram to stderr */
+    void print_pacer_stats (pacer_inst* pacerx);
+
+    /* Destroy pacer instance */
+    void destroy_pacer (pacer_inst* pacerx);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,101 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "6502.h"
+#include "memory.h"
+#include "pool.h"
+
+pool_inst*
+make_pool (int size)
+{
+    pool_inst *poolx;
+    int i;
+
+    poolx = (pool_inst*) malloc (sizeof(pool_inst));
+    poolx->luts  = init_6502_engine ();
+    poolx->all   = (cpu_inst**) malloc (size * sizeof(cpu_inst*));
+    poolx->free  = (cpu_inst**) malloc (size * sizeof(cpu_inst*));
+    poolx->size  = size;
+    poolx->nfree = size;
+
+    for (i=0; i<size; i++) {
+        poolx->all[i] = make_instance (poolx->luts);
+        poolx->free[i] = poolx->all[i];
+    }
+
+    pthread_mutex_init (&poolx->lock, 0);
+
+    return poolx;
+}
+
+
+cpu_inst*
+pool_get (pool_inst* poolx, nes_rom* rom)
+{
+    const mapper_desc *mapper = find_mapper (rom->mapper);
+    cpu_inst *cpux = 0;
+
+    if (!mapper) {
+        return 0;
+    }
+
+    pthread_mutex_lock (&poolx->lock);
+    if (poolx->nfree) {
+        cpux = poolx->free[--poolx->nfree];
+    }
+    pthread_mutex_unlock (&poolx->lock);
+
+    if (!cpux) {
+        return 0;
+    }
+
+    // The reset happens outside of the lock: the instance is ours
+    cpux->rom0 = rom;
+    cpux->mapper_id = rom->mapper;
+    cpux->mapper = mapper;
+    reset_instance (cpux);
+
+    return cpux;
+}
+
+
+void
+pool_put (pool_inst* poolx, cpu_inst* cpux)
+{
+    pthread_mutex_lock (&poolx->lock);
+    poolx->free[poolx->nfree++] = cpux;
+    pthread_mutex_unlock (&poolx->lock);
+}
+
+
+void
+destroy_pool (pool_inst* poolx)
+{
+    int i;
+
+    for (i=0; i<poolx->size; i++) {
+        destroy_instance (poolx->all[i]);
+    }
+
+    pthread_mutex_destroy (&poolx->lock);
+    unload_6502_engine (&poolx->luts);
+    free (poolx->all);
+    free (poolx->free);
+    free (poolx);
+}
@@ -0,0 +1,66 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _pool_h_
+#define _pool_h_
+
+#include <pthread.h>
+#include "6502_types.h"
+#include "6502.h"
+#include "romreader.h"
+
+// A fixed set of pre-allocated instances for jobs that run many
+// short-lived emulations.  The 6502 LUTs are built once for the
+// whole pool, and an instance is recycled with reset_instance
+// (a power cycle in place) instead of being rebuilt.
+
+typedef struct pool_instance pool_inst;
+struct pool_instance {
+
+    cpu_luts *luts;         // shared by every instance
+    cpu_inst **all;         // every instance (for destroy_pool)
+    cpu_inst **free;        // stack of instances not handed out
+    int size;               // # of instances
+    int nfree;              // # on the free stack
+
+    pthread_mutex_t lock;   // pool_get/pool_put may be threaded
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* Builds the LUTs and allocates size headless instances */
+pool_inst* make_pool (int size);
+
+/* Hands out an instance, power cycled with rom attached and its
+ * mapper set up.  Returns 0 if every instance is in use or the
+ * mapper is not supported. */
+cpu_inst* pool_get (pool_inst* poolx, nes_rom* rom);
+
+/* Returns an instance to the pool */
+void pool_put (pool_inst* poolx, cpu_inst* cpux);
+
+/* Frees every instance (handed out or not) and the LUTs */
+void destroy_pool (pool_inst* poolx);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
@@ -15,14 +15,63 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <SDL.h>
 #include "6502.h"
+#include "memory.h"
 #include "display.h"
+#include "vdump.h"
+#include "pacer.h"
+#include "romdb.h"
+#include "state.h"
+#include "rewind.h"
+#include "sram.h"
+
+static void
+print_usage ()
+{
+    printf ("Usage: retrobox [options] rom.nes\n\n");
+    printf ("Options:\n");
+    printf ("  --dump-video FILE   record video to FILE (\"-\" for stdout)\n");
+    printf ("                      .y4m files get YUV4MPEG2, anything else raw RGB24\n");
+    printf ("  --frame-hashes FILE log a 64-bit hash of every frame to FILE\n");
+    printf ("  --no-throttle       run flat out instead of at 60.0988 Hz\n");
+    printf ("  --pace-stats        print a frame pacing histogram on exit\n");
+    printf ("  --frameskip N       skip up to N frames in a row when running late\n");
+    printf ("  --ntsc              emulate NTSC composite video artifacts\n");
+    printf ("  --romdb FILE        correct bad iNES headers from a ROM database\n");
+    printf ("                      (default: $RETROBOX_ROMDB)\n");
+    printf ("  --rewind            keep rewind history (hold Backspace to rewind)\n");
+    printf ("\n");
+    printf ("Keys:\n");
+    printf ("  F5                  save state (quick slot)\n");
+    printf ("  F7                  load state (quick slot)\n");
+    printf ("  Backspace           rewind (with --rewind)\n");
+    printf ("\n");
+}
 
 int
 main (int argc, char* argv[])
 {
+    int i;
     SDL_Event event;
+    char *rom_file = 0;     /* ROM to load */
+    char *dump_file = 0;    /* Video dump destination */
+    char *hash_file = 0;    /* Frame hash log */
+    int throttle = 1;       /* Pace to real time? */
+    int pace_stats = 0;     /* Report pacing on exit? */
+    int frameskip = 0;      /* Max consecutive skipped frames */
+    int ntsc = 0;           /* NTSC composite filter? */
+    char *romdb_file = getenv ("RETROBOX_ROMDB");
+    romdb_inst *romdb;
+    void *quick_state;      /* F5/F7 save state slot */
+    int quick_saved = 0;
+    int rewind = 0;         /* Keep rewind history? */
+    int rewinding = 0;      /* Rewind key held */
+    int quit = 0;
+    int dump_format;
 
     cpu_luts *cluts;        /* CPU Engine LUTs */
     cpu_inst *cpu0;         /* CPU Instance 0  */
@@ -30,56 +79,205 @@ main (int argc, char* argv[])
     ppu_inst *ppu0;         /* PPU Instance 0 */
     disp_inst* display0;    /* NTSC Display */
     nes_rom* rom0;          /* Nintendo ROM Dump  */
+    pacer_inst* pacer0;     /* Frame Pacer */
+    rewind_inst* rewind0 = 0;   /* Rewind History */
+    sram_inst* sram0 = 0;       /* Battery SRAM */
 
 
+    /* parse the command line */
+    for (i=1; i<argc; i++) {
+        if (!strcmp (argv[i], "--dump-video") && (i+1 < argc)) {
+            dump_file = argv[++i];
+        } else if (!strcmp (argv[i], "--frame-hashes") && (i+1 < argc)) {
+            hash_file = argv[++i];
+        } else if (!strcmp (argv[i], "--no-throttle")) {
+            throttle = 0;
+        } else if (!strcmp (argv[i], "--pace-stats")) {
+            pace_stats = 1;
+        } else if (!strcmp (argv[i], "--frameskip") && (i+1 < argc)) {
+            frameskip = atoi (argv[++i]);
+        } else if (!strcmp (argv[i], "--ntsc")) {
+            ntsc = 1;
+        } else if (!strcmp (argv[i], "--rewind")) {
+            rewind = 1;
+        } else if (!strcmp (argv[i], "--romdb") && (i+1 < argc)) {
+            romdb_file = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            print_usage ();
+            exit (0);
+        } else {
+            rom_file = argv[i];
+        }
+    }
+
     /* open rom from command line */
-    if (argc > 1) {
-        rom0 = read_rom (argv[1]);
+    if (rom_file) {
+        rom0 = read_rom (rom_file);
     } else {
         printf ("No input ROM specified.\n\n");
+        print_usage ();
         exit (0);
     }
 
+    /* fix up known-bad headers before anything is mapped */
+    if (romdb_file && (romdb = open_romdb (romdb_file))) {
+        romdb_fix (romdb, rom0);
+        close_romdb (romdb);
+    }
+
     /* bring up some Video */
     init_display ();
-    display0 = make_display (
-                  256,        // width
-                  240,        // height
-                  32,         // bit depth
-                  0,          // 0 = windowed, 1 = fullscreen
-                  0           // interpolation mode
-              );
+    if (ntsc) {
+        display0 = make_display (
+                      NTSC_OUT_WIDTH,   // width
+                      480,              // height (line doubled)
+                      32,               // bit depth
+                      0,                // 0 = windowed, 1 = fullscreen
+                      3                 // NTSC composite filter
+                  );
+    } else {
+        display0 = make_display (
+                      256,        // width
+                      240,        // height
+                      32,         // bit depth
+                      0,          // 0 = windowed, 1 = fullscreen
+                      0           // interpolation mode
+                  );
+    }
+
+    /* start recording? */
+    if (dump_file) {
+        i = strlen (dump_file);
+        if ((i > 4) && !strcmp (dump_file + i - 4, ".y4m")) {
+            dump_format = VDUMP_Y4M;
+        } else {
+            dump_format = VDUMP_RGB;
+        }
+        display0->vdump = make_vdump (dump_file, dump_format, display0->palette);
+    }
+
+    /* log frame hashes? */
+    if (hash_file) {
+        if (!strcmp (hash_file, "-")) {
+            display0->hash_log = stdout;
+        } else if (!(display0->hash_log = fopen (hash_file, "w"))) {
+            printf ("Unable to open %s\n\n", hash_file);
+            exit (0);
+        }
+        display0->hash_frames = 1;
+    }
 
     /* get 6502 running & all memory mapped up */
     cluts = init_6502_engine ();
-    cpu0 = make_cpu (cluts);
-    ppu0 = make_ppu ();
-    init_nes_memorymap (cpu0, ppu0);
+    cpu0 = make_instance (cluts);
+    ppu0 = cpu0->ppux;
     ppu0->displayx = display0;
 
     /* setup mapper and run its init routine */
-    cpu0->mapper_id = rom0->mapper;
-    cpu0->rom0 = rom0;
-    cpu0->mapper[cpu0->mapper_id](cpu0, 1);
+    if (attach_rom (cpu0, rom0) < 0) {
+        printf ("Mapper %i (%s) not yet implemented.\nExiting...\n\n",
+                rom0->mapper, mapper_name (rom0->mapper));
+        exit (0);
+    }
     reset_cpu (cpu0);
 
+    /* battery backed games keep SRAM in a .sav file */
+    if (rom0->flg_sram) {
+        sram0 = make_sram (rom_file, cpu0);
+    }
+
+    quick_state = malloc (state_size ());
+    if (rewind) {
+        rewind0 = make_rewind (REWIND_BUFFER, REWIND_INTERVAL);
+    }
+
+    pacer0 = make_pacer (PACER_NTSC_HZ, throttle);
+    pacer0->skip_max = frameskip;
+
     // Main event loop... 
-    for (;;) {
-        SDL_PollEvent (&event);
+    while (!quit) {
+        // (returns early at the end of each frame)
+        run_cpu (cpu0, PPU_FRAME_CYCLES / 3);
+
+        // Once per frame: hold to the frame clock & handle events
+        if (ppu0->frame_ready) {
+            ppu0->frame_ready = 0;
 
-        run_cpu (cpu0, 1);
+            pace_frame (pacer0);
+            ppu0->skip = pacer0->skip_next;
 
-        if (event.type == SDL_QUIT) {
-            break;
+            while (SDL_PollEvent (&event)) {
+                if (event.type == SDL_QUIT) {
+                    quit = 1;
+                }
+                else if (event.type == SDL_KEYDOWN) {
+                    switch (event.key.keysym.sym)
+                    {
+                        case SDLK_F5:
+                            quick_saved = save_state (cpu0, quick_state, state_size ()) > 0;
+                            break;
+                        case SDLK_F7:
+                            if (quick_saved) {
+                                load_state (cpu0, quick_state, state_size ());
+                            }
+                            break;
+                        case SDLK_BACKSPACE:
+                            rewinding = 1;
+                            break;
+                        default:
+                            break;
+                    }
+                }
+                else if (event.type == SDL_KEYUP) {
+                    if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                        rewinding = 0;
+                    }
+                }
+            }
+
+            // Either record history or play it backwards
+            if (rewind0) {
+                if (rewinding) {
+                    rewind_step (rewind0, cpu0);
+                } else {
+                    rewind_frame (rewind0, cpu0);
+                }
+            }
         }
     }
 
+    if (pace_stats) {
+        print_pacer_stats (pacer0);
+    }
+    destroy_pacer (pacer0);
+    free (quick_state);
+    if (rewind0) {
+        destroy_rewind (rewind0);
+    }
+    if (sram0) {
+        destroy_sram (sram0);
+    }
+    destroy_instance (cpu0);
+
+    // Flush & close any video dump
+    if (display0->vdump) {
+        destroy_vdump (display0->vdump);
+    }
+
+    // Close the frame hash log
+    if (display0->hash_log && display0->hash_log != stdout) {
+        fclose (display0->hash_log);
+    }
+
     // Destroy display instance
     destroy_display (display0);
 
     // Unload Video Sub-System
     unload_display ();
 
+    // Release the ROM image
+    unload_rom (&rom0);
+
     return 0;
 }
 
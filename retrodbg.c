@@ -28,6 +28,7 @@
 #include "6502.h"
 #include "6502_types.h"
 #include "2C02.h"
+#include "memory.h"
 #include "timer.h"
 #include "disasm.h"
 #include "romreader.h"
@@ -64,7 +65,8 @@ print_stack (cpu_inst *cpux)
     printf ("Starting from 0x%.2X:\n", SPtmp++);
     for (j=0; j < 16; j++) {
         for (i=0; i < 16; i++) {
-            printf ("%.2X ", *cpux->mmap[0x0100+SPtmp++]);
+            printf ("%.2X ", MMAP_BYTE (cpux->mmap, 0x0100+SPtmp));
+            SPtmp++;
         }
         printf ("\n");
     }
@@ -108,121 +110,7 @@ print_rom_info (nes_rom *romx)
             printf ("   Mirroring: 4-way\n");
             break;
     }
-    printf ("      Mapper: %i ", romx->mapper);
-    switch (romx->mapper)
-    {
-        case 0:
-            printf ("(NROM)\n");
-            break;
-        case 1:
-            printf ("(Nintendo MMC1)\n");
-            break;
-        case 2:
-            printf ("(UNROM switch)\n");
-            break;
-        case 3:
-            printf ("(CNROM switch)\n");
-            break;
-        case 4:
-            printf ("(Nintendo MMC3)\n");
-            break;
-        case 5:
-            printf ("(Nintendo MMC5)\n");
-            break;
-        case 6:
-            printf ("(FFE F4xxx)\n");
-            break;
-        case 7:
-            printf ("(AOROM switch)\n");
-            break;
-        case 8:
-            printf ("(FFE F3xxx)\n");
-            break;
-        case 9:
-            printf ("(Nintendo MMC2)\n");
-            break;
-        case 10:
-            printf ("(Nintendo MMC4)\n");
-            break;
-        case 11:
-            printf ("(ColorDreams chip)\n");
-            break;
-        case 12:
-            printf ("(FFE F6xxx)\n");
-            break;
-        case 15:
-            printf ("(100-in-1 switch)\n");
-            break;
-        case 16:
-            printf ("(Bandai chip)\n");
-            break;
-        case 17:
-            printf ("(FFE F8xxx)\n");
-            break;
-        case 18:
-            printf ("(Jaleco SS8806)\n");
-            break;
-        case 19:
-            printf ("(Namcot 106 chip)\n");
-            break;
-        case 20:
-            printf ("(Nintendo DiskSystem)\n");
-            break;
-        case 21:
-            printf ("(Konami VRC4a)\n");
-            break;
-        case 22:
-            printf ("(Konami VRC2a)\n");
-            break;
-        case 23:
-            printf ("(Konami VRC2a)\n");
-            break;
-        case 24:
-            printf ("(Konami VRC6)\n");
-            break;
-        case 25:
-            printf ("(Konami VRC4b)\n");
-            break;
-        case 32:
-            printf ("(Irem G-101 chip)\n");
-            break;
-        case 33:
-            printf ("(Taito TC0190/TC0350)\n");
-            break;
-        case 34:
-            printf ("(32KB ROM switch)\n");
-            break;
-        case 64:
-            printf ("(Tengen RAMBO-1 chip)\n");
-            break;
-        case 65:
-            printf ("(Irem H-3001 chip)\n");
-            break;
-        case 66:
-            printf ("(GRROM switch)\n");
-            break;
-        case 67:
-            printf ("(SunSoft3 chip)\n");
-            break;
-        case 68:
-            printf ("(SunSoft4 chip)\n");
-            break;
-        case 69:
-            printf ("(SunSoft5 FME-7 chip)\n");
-            break;
-        case 71:
-            printf ("(Camerica chip)\n");
-            break;
-        case 78:
-            printf ("(Irem 74HC161/32-based)\n");
-            break;
-        case 91:
-            printf ("(Pirate HK-SF3 chip)\n");
-            break;
-        default:
-            printf ("(Unknown)\n");
-            break;
-    }
+    printf ("      Mapper: %i (%s)\n", romx->mapper, mapper_name (romx->mapper));
     switch (romx->flg_tv)
     {
         case 0x00:
@@ -273,15 +161,16 @@ main (int argc, char* argv[])
 
     /* Get 6502 running & all memory mapped up */
     cluts = init_6502_engine ();
-    cpu0 = make_cpu (cluts);
-    ppu0 = make_ppu ();
-    init_nes_memorymap (cpu0, ppu0);
+    cpu0 = make_instance (cluts);
+    ppu0 = cpu0->ppux;
     ppu0->displayx = display0;
 
     /* Setup Mapper and run its init routine */
-    cpu0->mapper_id = rom0->mapper;
-    cpu0->rom0 = rom0;
-    cpu0->mapper[cpu0->mapper_id](cpu0, 1);
+    if (attach_rom (cpu0, rom0) < 0) {
+        printf ("Mapper %i (%s) not yet implemented.\nExiting...\n\n",
+                rom0->mapper, mapper_name (rom0->mapper));
+        exit (0);
+    }
     reset_cpu (cpu0);
 
 
@@ -306,7 +195,7 @@ main (int argc, char* argv[])
                 for (i=0; i<4000000; i++) {
                     run_cpu (cpu0, 1);
                 }
-                printf ("\nResult:\n%s\n", cpu0->mmap[0x6004]);
+                printf ("\nResult:\n%s\n", &MMAP_BYTE (cpu0->mmap, 0x6004));
                 break;
 
             // eXecute
@@ -386,15 +275,15 @@ main (int argc, char* argv[])
                 printf ("\n");
                 printf (" scanline: %i\n", ppu0->scanline);
                 printf ("linecycle: %u\n", ppu0->linecycle);
-                printf ("0xFFFE: %.2X\n", *cpu0->mmap[0xFFFE]);
-                printf ("0xFFFF: %.2X\n", *cpu0->mmap[0xFFFF]);
-//                printf ("NMI: 0x%.2X%.2X\n", *cpu0->mmap[0xFFFB], *cpu0->mmap[0xFFFA]);
+                printf ("0xFFFE: %.2X\n", MMAP_BYTE (cpu0->mmap, 0xFFFE));
+                printf ("0xFFFF: %.2X\n", MMAP_BYTE (cpu0->mmap, 0xFFFF));
+//                printf ("NMI: 0x%.2X%.2X\n", MMAP_BYTE (cpu0->mmap, 0xFFFB), MMAP_BYTE (cpu0->mmap, 0xFFFA));
                 break;
 
             // Dump PPU Palettes
             case '9':
                 for (i=0x00; i<0x20; i++) {
-                    printf ("PPU %.4X\t%.2X\n", (i | 0x3F00), *ppu0->mmap[(0x3F00 | i)]);
+                    printf ("PPU %.4X\t%.2X\n", (i | 0x3F00), ppu0->PALETTES[i]);
                 }
                 break;
 
@@ -416,7 +305,7 @@ main (int argc, char* argv[])
                 printf ("Nametable 1:\n");
                 for (j=0; j<30; j++) {
                     for (i=0; i<32; i++) {
-                        printf ("%.2X ", *ppu0->mmap[0x2000 | (j*32 + i)]);
+                        printf ("%.2X ", MMAP_BYTE (ppu0->mmap, 0x2000 | (j*32 + i)));
                     }
                     printf ("\n");
                 }
@@ -427,7 +316,7 @@ main (int argc, char* argv[])
                 printf ("Nametable 2:\n");
                 for (j=0; j<30; j++) {
                     for (i=0; i<32; i++) {
-                        printf ("%.2X ", *ppu0->mmap[0x2400 | (j*32 + i)]);
+                        printf ("%.2X ", MMAP_BYTE (ppu0->mmap, 0x2400 | (j*32 + i)));
                     }
                     printf ("\n");
                 }
@@ -438,7 +327,7 @@ main (int argc, char* argv[])
                 printf ("Nametable 3:\n");
                 for (j=0; j<30; j++) {
                     for (i=0; i<32; i++) {
-                        printf ("%.2X ", *ppu0->mmap[0x2800 | (j*32 + i)]);
+                        printf ("%.2X ", MMAP_BYTE (ppu0->mmap, 0x2800 | (j*32 + i)));
                     }
                     printf ("\n");
                 }
@@ -449,7 +338,7 @@ main (int argc, char* argv[])
                 printf ("Nametable 4:\n");
                 for (j=0; j<30; j++) {
                     for (i=0; i<32; i++) {
-                        printf ("%.2X ", *ppu0->mmap[0x2C00 | (j*32 + i)]);
+                        printf ("%.2X ", MMAP_BYTE (ppu0->mmap, 0x2C00 | (j*32 + i)));
                     }
                     printf ("\n");
                 }
@@ -479,13 +368,8 @@ main (int argc, char* argv[])
     /* Unload disassembly engine */
     unload_disasm_engine (&dluts);
 
-    /* Free 6502 RAMs */
-    free (cpu0->mmap[0x0000]);  //  RAM (malloced pointer)
-    free (cpu0->mmap[0x2000]);  //  I/O (malloced pointer)
-    free (cpu0->mmap[0x6000]);  // SRAM (malloced pointer)
-
-    /* Destroy our virtual 6502 CPU */
-    destroy_cpu (&cpu0);
+    /* Destroy our virtual NES (CPU, PPU & RAMs) */
+    destroy_instance (cpu0);
 
     /* Unload the 6502 engine */
     unload_6502_engine (&cluts);
@@ -0,0 +1,259 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "rewind.h"
+#include "state.h"
+
+/* A literal run ends at this many unchanged bytes in a row */
+#define MIN_ZERO_RUN 4
+
+static byte*
+put_varint (byte *out, size_t v)
+{
+    while (v >= 0x80) {
+        *out++ = (byte) (v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (byte) v;
+    return out;
+}
+
+static const byte*
+get_varint (const byte *in, size_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    do {
+        *v |= (size_t) (*in & 0x7F) << shift;
+        shift += 7;
+    } while (*in++ & 0x80);
+
+    return in;
+}
+
+// Encodes a XOR b as a list of (unchanged run, literal run, literals)
+// triples.  Returns the # of bytes written to out, which must hold
+// at least 2*n + 16 bytes.
+static size_t
+pack_delta (const byte *a, const byte *b, size_t n, byte *out)
+{
+    byte *start = out;
+    size_t i = 0;
+    size_t z, l, k;
+    uint64_t x, y;
+
+    while (i < n) {
+        // Unchanged bytes, a word at a time where possible
+        z = i;
+        while (i + 8 <= n) {
+            memcpy (&x, a + i, 8);
+            memcpy (&y, b + i, 8);
+            if (x != y) {
+                break;
+            }
+            i += 8;
+        }
+        while (i < n && a[i] == b[i]) {
+            i++;
+        }
+
+        // Changed bytes (short unchanged gaps are cheaper inline)
+        l = i;
+        while (i < n) {
+            if (a[i] == b[i]) {
+                for (k=1; k<MIN_ZERO_RUN && i+k<n && a[i+k] == b[i+k]; k++);
+                if (k == MIN_ZERO_RUN || i+k == n) {
+                    break;
+                }
+                i += k;
+            } else {
+                i++;
+            }
+        }
+
+        out = put_varint (out, l - z);
+        out = put_varint (out, i - l);
+        for (k=l; k<i; k++) {
+            *out++ = a[k] ^ b[k];
+        }
+    }
+
+    return out - start;
+}
+
+// XORs a packed delta into dst
+static void
+unpack_delta (const byte *in, size_t len, byte *dst)
+{
+    const byte *end = in + len;
+    size_t skip, lit;
+
+    while (in < end) {
+        in = get_varint (in, &skip);
+        in = get_varint (in, &lit);
+        dst += skip;
+        while (lit--) {
+            *dst++ ^= *in++;
+        }
+    }
+}
+
+static void
+ring_write (rewind_inst* rw, const byte *src, size_t len)
+{
+    size_t first = rw->ring_size - rw->ring_head;
+
+    if (first > len) {
+        first = len;
+    }
+    memcpy (rw->ring + rw->ring_head, src, first);
+    memcpy (rw->ring, src + first, len - first);
+    rw->ring_head = (rw->ring_head + len) % rw->ring_size;
+}
+
+static void
+ring_read (rewind_inst* rw, rewind_record *rec, byte *dst)
+{
+    size_t first = rw->ring_size - rec->offset;
+
+    if (first > rec->len) {
+        first = rec->len;
+    }
+    memcpy (dst, rw->ring + rec->offset, first);
+    memcpy (dst + first, rw->ring, rec->len - first);
+}
+
+static void
+push_delta (rewind_inst* rw, size_t len)
+{
+    rewind_record *rec;
+
+    if (len > rw->ring_size) {
+        return;
+    }
+
+    // Make room by forgetting the oldest history
+    while (rw->count && ((rw->ring_used + len > rw->ring_size) ||
+                         (rw->count == rw->max_records))) {
+        rw->ring_used -= rw->records[rw->first].len;
+        rw->first = (rw->first + 1) % rw->max_records;
+        rw->count--;
+    }
+
+    rec = &rw->records[(rw->first + rw->count) % rw->max_records];
+    rec->offset = rw->ring_head;
+    rec->len = len;
+    ring_write (rw, rw->packed, len);
+
+    rw->ring_used += len;
+    rw->count++;
+}
+
+// ----------
+
+rewind_inst*
+make_rewind (size_t buffer_size, int interval)
+{
+    rewind_inst *rw;
+
+    rw = (rewind_inst*) malloc (sizeof(rewind_inst));
+    memset (rw, 0, sizeof(rewind_inst));
+
+    rw->interval = (interval > 0) ? interval : 1;
+    rw->size = state_size ();
+
+    rw->cur    = (byte*) malloc (rw->size);
+    rw->next   = (byte*) malloc (rw->size);
+    rw->packed = (byte*) malloc (2*rw->size + 16);
+
+    rw->ring_size = buffer_size;
+    rw->ring = (byte*) malloc (buffer_size);
+
+    // Even a frame where nothing changed costs a few bytes
+    rw->max_records = buffer_size / 256 + 1;
+    rw->records = (rewind_record*) malloc (rw->max_records * sizeof(rewind_record));
+
+    return rw;
+}
+
+
+void
+rewind_frame (rewind_inst* rw, cpu_inst* cpux)
+{
+    byte *tmp;
+
+    if (rw->countdown-- > 0) {
+        return;
+    }
+    rw->countdown = rw->interval - 1;
+
+    save_state (cpux, rw->next, rw->size);
+    if (rw->have_cur) {
+        push_delta (rw, pack_delta (rw->next, rw->cur, rw->size, rw->packed));
+    }
+
+    tmp = rw->cur;
+    rw->cur = rw->next;
+    rw->next = tmp;
+    rw->have_cur = 1;
+}
+
+
+int
+rewind_step (rewind_inst* rw, cpu_inst* cpux)
+{
+    rewind_record *rec;
+
+    if (!rw->have_cur) {
+        return 0;
+    }
+
+    load_state (cpux, rw->cur, rw->size);
+
+    // Turn cur into the snapshot before it
+    if (rw->count) {
+        rec = &rw->records[(rw->first + rw->count - 1) % rw->max_records];
+        ring_read (rw, rec, rw->packed);
+        unpack_delta (rw->packed, rec->len, rw->cur);
+
+        rw->ring_head = rec->offset;
+        rw->ring_used -= rec->len;
+        rw->count--;
+    } else {
+        rw->have_cur = 0;
+    }
+
+    rw->countdown = rw->interval - 1;
+
+    return 1;
+}
+
+
+void
+destroy_rewind (rewind_inst* rw)
+{
+    free (rw->records);
+    free (rw->ring);
+    free (rw->packed);
+    free (rw->next);
+    free (rw->cur);
+    free (rw);
+}
@@ -0,0 +1,89 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _rewind_h_
+#define _rewind_h_
+
+#include <stddef.h>
+#include "6502_types.h"
+#include "6502.h"
+
+/* Defaults used by retrobox */
+#define REWIND_INTERVAL 2                   /* frames between snapshots */
+#define REWIND_BUFFER   (16*1024*1024)      /* bytes of compressed history */
+
+// Rewind history.
+//
+// Only the newest snapshot is kept whole (cur).  Every older one is
+// stored in a ring as the XOR of itself and the snapshot after it,
+// zero-run compressed.  Stepping back XORs the newest delta into cur,
+// which yields the previous snapshot; once the ring is full the
+// oldest deltas are simply dropped.
+
+typedef struct rewind_record_struct rewind_record;
+struct rewind_record_struct {
+    size_t offset;          // start in ring (may wrap)
+    size_t len;             // compressed bytes
+};
+
+typedef struct rewind_instance rewind_inst;
+struct rewind_instance {
+
+    int interval;           // frames between snapshots
+    int countdown;          // frames until the next snapshot
+
+    size_t size;            // save state size
+    byte *cur;              // newest snapshot (uncompressed)
+    byte *next;             // scratch snapshot
+    byte *packed;           // scratch compressed delta (worst case)
+    int have_cur;
+
+    /* Compressed deltas, oldest first */
+    byte *ring;
+    size_t ring_size;
+    size_t ring_head;       // where the next delta is written
+    size_t ring_used;
+
+    rewind_record *records;
+    unsigned int max_records;
+    unsigned int first;     // oldest record
+    unsigned int count;
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+rewind_inst* make_rewind (size_t buffer_size, int interval);
+
+/* Call once per emulated frame.  Every interval frames the
+ * machine is snapshotted into the history. */
+void rewind_frame (rewind_inst* rw, cpu_inst* cpux);
+
+/* Restores the newest snapshot and drops it from the history, so
+ * repeated calls play the history backwards.  Returns 0 once the
+ * history is used up. */
+int rewind_step (rewind_inst* rw, cpu_inst* cpux);
+
+void destroy_rewind (rewind_inst* rw);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
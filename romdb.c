@@ -0,0 +1,193 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "romdb.h"
+#include "romreader.h"
+
+// Orders entries by crc32, then sha1
+static int
+compare_key (uint32_t crc, const byte *sha1, const romdb_entry* entry)
+{
+    if (crc < entry->crc32) {
+        return -1;
+    }
+    if (crc > entry->crc32) {
+        return 1;
+    }
+    return memcmp (sha1, entry->sha1, 20);
+}
+
+static int
+compare_entries (const void *a, const void *b)
+{
+    const romdb_entry *ea = (const romdb_entry*) a;
+    return compare_key (ea->crc32, ea->sha1, (const romdb_entry*) b);
+}
+
+// ----------
+
+romdb_inst*
+open_romdb (char *filename)
+{
+    romdb_inst *dbx;
+    romdb_header *header;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat (fd, &st) < 0 || st.st_size < (off_t) sizeof(romdb_header)) {
+        close (fd);
+        return 0;
+    }
+
+    map = mmap (0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    // Sanity check the header against the file size
+    header = (romdb_header*) map;
+    if (memcmp (header->magic, ROMDB_MAGIC, 4) ||
+        (header->version != ROMDB_VERSION) ||
+        (header->entry_size != sizeof(romdb_entry)) ||
+        (sizeof(romdb_header) + (off_t) header->count * sizeof(romdb_entry) > st.st_size)) {
+        fprintf (stderr, "romdb: %s is not a valid ROM database\n", filename);
+        munmap (map, st.st_size);
+        return 0;
+    }
+
+    dbx = (romdb_inst*) malloc (sizeof(romdb_inst));
+    dbx->header   = header;
+    dbx->entries  = (romdb_entry*) (header + 1);
+    dbx->count    = header->count;
+    dbx->map_size = st.st_size;
+
+    return dbx;
+}
+
+
+romdb_entry*
+romdb_lookup (romdb_inst* dbx, nes_rom* rom)
+{
+    unsigned int lo = 0;
+    unsigned int hi = dbx->count;
+    unsigned int mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        cmp = compare_key (rom->crc32, rom->sha1, &dbx->entries[mid]);
+        if (cmp == 0) {
+            return &dbx->entries[mid];
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int
+romdb_fix (romdb_inst* dbx, nes_rom* rom)
+{
+    romdb_entry *entry;
+
+    if (!rom->hashed) {
+        hash_rom (rom);
+    }
+
+    entry = romdb_lookup (dbx, rom);
+    if (!entry) {
+        return 0;
+    }
+
+    if ((entry->fix & ROMDB_MAPPER) && (rom->mapper != entry->mapper)) {
+        printf ("romdb: mapper %i -> %i\n", rom->mapper, entry->mapper);
+        rom->mapper = entry->mapper;
+    }
+    // (a damaged database must not hand set_mirroring a bad mode)
+    if ((entry->fix & ROMDB_MIRRORING) && (entry->mirroring > MIRROR_SINGLE_B)) {
+        printf ("romdb: ignoring invalid mirroring %i\n", entry->mirroring);
+    } else if ((entry->fix & ROMDB_MIRRORING) && (rom->flg_mirroring != entry->mirroring)) {
+        printf ("romdb: mirroring %i -> %i\n", rom->flg_mirroring, entry->mirroring);
+        rom->flg_mirroring = entry->mirroring;
+    }
+    if ((entry->fix & ROMDB_PRGRAM) && (rom->prg_ram_size != entry->prg_ram_size)) {
+        printf ("romdb: PRG-RAM size %i -> %i\n", rom->prg_ram_size, entry->prg_ram_size);
+        rom->prg_ram_size = entry->prg_ram_size;
+    }
+    if ((entry->fix & ROMDB_BATTERY) && (rom->flg_sram != entry->battery)) {
+        printf ("romdb: battery %i -> %i\n", rom->flg_sram, entry->battery);
+        rom->flg_sram = entry->battery;
+    }
+    if ((entry->fix & ROMDB_TV) && (rom->flg_tv != entry->tv)) {
+        printf ("romdb: TV format %i -> %i\n", rom->flg_tv, entry->tv);
+        rom->flg_tv = entry->tv;
+    }
+
+    return 1;
+}
+
+
+void
+close_romdb (romdb_inst* dbx)
+{
+    munmap (dbx->header, dbx->map_size);
+    free (dbx);
+}
+
+
+int
+write_romdb (char *filename, romdb_entry* entries, unsigned int count)
+{
+    romdb_header header;
+    FILE *fp;
+
+    qsort (entries, count, sizeof(romdb_entry), compare_entries);
+
+    memcpy (header.magic, ROMDB_MAGIC, 4);
+    header.version    = ROMDB_VERSION;
+    header.count      = count;
+    header.entry_size = sizeof(romdb_entry);
+
+    fp = fopen (filename, "wb");
+    if (!fp) {
+        return -1;
+    }
+    if ((fwrite (&header, sizeof(header), 1, fp) != 1) ||
+        (count && fwrite (entries, sizeof(romdb_entry), count, fp) != count)) {
+        fclose (fp);
+        return -1;
+    }
+
+    return fclose (fp);
+}
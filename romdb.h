@@ -0,0 +1,101 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _romdb_h_
+#define _romdb_h_
+
+#include <stdint.h>
+#include "6502_types.h"
+#include "romreader.h"
+
+// ROM database file layout (host byte order):
+//
+//   offset  size
+//   ------  ----
+//        0     4   magic "RBDB"
+//        4     4   version (ROMDB_VERSION)
+//        8     4   # of entries
+//       12     4   sizeof(romdb_entry)
+//       16   32*n  entries, sorted by (crc32, sha1)
+//
+// The file is mmap()ed and binary searched in place.
+
+#define ROMDB_MAGIC     "RBDB"
+#define ROMDB_VERSION   1
+
+/* Which header fields an entry corrects */
+#define ROMDB_MAPPER    BIT0
+#define ROMDB_MIRRORING BIT1
+#define ROMDB_PRGRAM    BIT2
+#define ROMDB_BATTERY   BIT3
+#define ROMDB_TV        BIT4
+
+typedef struct romdb_header_struct romdb_header;
+struct romdb_header_struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t entry_size;
+};
+
+typedef struct romdb_entry_struct romdb_entry;
+struct romdb_entry_struct {
+    uint32_t crc32;         // of PRG-ROM + CHR-ROM
+    byte sha1[20];          // of PRG-ROM + CHR-ROM
+    byte fix;               // ROMDB_* mask of valid fields below
+    byte mapper;
+    byte mirroring;         // MIRROR_xxx: 0 = horiz., 1 = vert.,
+                            //  2 = 4-screen, 3/4 = single screen A/B
+    byte prg_ram_size;      // # of 8KB blocks
+    byte battery;           // 1 = battery backed SRAM
+    byte tv;                // 0 = NTSC, 1 = PAL
+    byte pad[2];
+};
+
+typedef struct romdb_instance romdb_inst;
+struct romdb_instance {
+    romdb_header *header;
+    romdb_entry *entries;
+    unsigned int count;
+    unsigned int map_size;
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* Maps a database file.  Returns 0 if missing or malformed. */
+romdb_inst* open_romdb (char *filename);
+
+/* Finds the entry for a (hashed) ROM, or 0 */
+romdb_entry* romdb_lookup (romdb_inst* dbx, nes_rom* rom);
+
+/* Hashes the ROM if needed and applies any header corrections.
+ * Returns 1 if the ROM was found in the database. */
+int romdb_fix (romdb_inst* dbx, nes_rom* rom);
+
+void close_romdb (romdb_inst* dbx);
+
+/* Sorts entries & writes a database file.  Returns 0 on success. */
+int write_romdb (char *filename, romdb_entry* entries, unsigned int count);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
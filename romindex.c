@@ -0,0 +1,173 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "romindex.h"
+
+// Orders entries by crc32, then sha1
+static int
+compare_key (uint32_t crc, const byte *sha1, const romindex_entry* entry)
+{
+    if (crc < entry->crc32) {
+        return -1;
+    }
+    if (crc > entry->crc32) {
+        return 1;
+    }
+    return memcmp (sha1, entry->sha1, 20);
+}
+
+static int
+compare_entries (const void *a, const void *b)
+{
+    const romindex_entry *ea = (const romindex_entry*) a;
+    const romindex_entry *eb = (const romindex_entry*) b;
+    int cmp;
+
+    cmp = compare_key (ea->crc32, ea->sha1, eb);
+    if (cmp) {
+        return cmp;
+    }
+
+    // Duplicates stay in a stable (path table) order
+    return (ea->path > eb->path) - (ea->path < eb->path);
+}
+
+// ----------
+
+romindex_inst*
+open_romindex (char *filename)
+{
+    romindex_inst *idx;
+    romindex_header *header;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat (fd, &st) < 0 || st.st_size < (off_t) sizeof(romindex_header)) {
+        close (fd);
+        return 0;
+    }
+
+    map = mmap (0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    // Sanity check the header against the file size
+    header = (romindex_header*) map;
+    if (memcmp (header->magic, ROMINDEX_MAGIC, 4) ||
+        (header->version != ROMINDEX_VERSION) ||
+        (header->entry_size != sizeof(romindex_entry)) ||
+        (sizeof(romindex_header) + (off_t) header->count * sizeof(romindex_entry) > header->paths) ||
+        ((off_t) header->paths + header->paths_size > st.st_size)) {
+        fprintf (stderr, "romindex: %s is not a valid ROM index\n", filename);
+        munmap (map, st.st_size);
+        return 0;
+    }
+
+    idx = (romindex_inst*) malloc (sizeof(romindex_inst));
+    idx->header   = header;
+    idx->entries  = (romindex_entry*) (header + 1);
+    idx->paths    = (const char*) map + header->paths;
+    idx->count    = header->count;
+    idx->map_size = st.st_size;
+
+    return idx;
+}
+
+
+romindex_entry*
+romindex_lookup (romindex_inst* idx, uint32_t crc, const byte *sha1)
+{
+    unsigned int lo = 0;
+    unsigned int hi = idx->count;
+    unsigned int mid;
+
+    // Lower bound, so the first of any duplicates is found
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (compare_key (crc, sha1, &idx->entries[mid]) > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < idx->count && !compare_key (crc, sha1, &idx->entries[lo])) {
+        return &idx->entries[lo];
+    }
+
+    return 0;
+}
+
+
+const char*
+romindex_path (romindex_inst* idx, romindex_entry* entry)
+{
+    return idx->paths + entry->path;
+}
+
+
+void
+close_romindex (romindex_inst* idx)
+{
+    munmap (idx->header, idx->map_size);
+    free (idx);
+}
+
+
+int
+write_romindex (char *filename, romindex_entry* entries, unsigned int count,
+                const char *paths, unsigned int paths_size)
+{
+    romindex_header header;
+    FILE *fp;
+
+    qsort (entries, count, sizeof(romindex_entry), compare_entries);
+
+    memcpy (header.magic, ROMINDEX_MAGIC, 4);
+    header.version    = ROMINDEX_VERSION;
+    header.count      = count;
+    header.entry_size = sizeof(romindex_entry);
+    header.paths      = sizeof(romindex_header) + count * sizeof(romindex_entry);
+    header.paths_size = paths_size;
+
+    fp = fopen (filename, "wb");
+    if (!fp) {
+        return -1;
+    }
+    if ((fwrite (&header, sizeof(header), 1, fp) != 1) ||
+        (count && fwrite (entries, sizeof(romindex_entry), count, fp) != count) ||
+        (paths_size && fwrite (paths, paths_size, 1, fp) != 1)) {
+        fclose (fp);
+        return -1;
+    }
+
+    return fclose (fp);
+}
@@ -0,0 +1,114 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _romindex_h_
+#define _romindex_h_
+
+#include <stdint.h>
+#include "6502_types.h"
+#include "romreader.h"
+
+// ROM corpus index file layout (host byte order):
+//
+//   offset  size
+//   ------  ----
+//        0     4   magic "RBIX"
+//        4     4   version (ROMINDEX_VERSION)
+//        8     4   # of entries
+//       12     4   sizeof(romindex_entry)
+//       16     4   offset of the path table
+//       20     4   size of the path table
+//       24   40*n  entries, sorted by (crc32, sha1)
+//        .     .   path table (NUL terminated strings)
+//
+// Like the ROM database, the file is meant to be mmap()ed and
+// binary searched in place.
+
+#define ROMINDEX_MAGIC      "RBIX"
+#define ROMINDEX_VERSION    1
+
+/* romindex_entry status for files that could not be read at all
+ * (otherwise status is ROM_OK or a read_ines() error code) */
+#define ROMINDEX_IO_ERROR   0xFF
+
+/* romindex_entry flags */
+#define ROMINDEX_BATTERY    BIT0
+#define ROMINDEX_TRAINER    BIT1
+#define ROMINDEX_VS         BIT2
+#define ROMINDEX_PLAYCHOICE BIT3
+#define ROMINDEX_NES20      BIT4
+
+typedef struct romindex_header_struct romindex_header;
+struct romindex_header_struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t entry_size;
+    uint32_t paths;         // file offset of the path table
+    uint32_t paths_size;
+};
+
+typedef struct romindex_entry_struct romindex_entry;
+struct romindex_entry_struct {
+    uint32_t crc32;         // of PRG-ROM + CHR-ROM (0 if status != ROM_OK)
+    byte sha1[20];
+    uint32_t path;          // offset into the path table
+    uint32_t file_size;
+    byte status;            // ROM_OK, ROM_* error or ROMINDEX_IO_ERROR
+    byte mapper;
+    byte prg_rom_size;      // # of 16KB blocks
+    byte chr_rom_size;      // # of  8KB blocks
+    byte prg_ram_size;      // # of  8KB blocks
+    byte mirroring;         // 0 = horizontal, 1 = vertical, 2 = 4-way
+    byte tv;                // 0 = NTSC, 1 = PAL
+    byte flags;             // ROMINDEX_*
+};
+
+typedef struct romindex_instance romindex_inst;
+struct romindex_instance {
+    romindex_header *header;
+    romindex_entry *entries;
+    const char *paths;
+    unsigned int count;
+    unsigned int map_size;
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* Maps an index file.  Returns 0 if missing or malformed. */
+romindex_inst* open_romindex (char *filename);
+
+/* Finds the first entry with the given hashes, or 0 */
+romindex_entry* romindex_lookup (romindex_inst* idx, uint32_t crc, const byte *sha1);
+
+/* Path of the file an entry was made from */
+const char* romindex_path (romindex_inst* idx, romindex_entry* entry);
+
+void close_romindex (romindex_inst* idx);
+
+/* Sorts entries & writes an index file.  Returns 0 on success. */
+int write_romindex (char *filename, romindex_entry* entries, unsigned int count,
+                    const char *paths, unsigned int paths_size);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
@@ -18,7 +18,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if !defined (_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <strings.h>
+#else
+#define strncasecmp _strnicmp
+#endif
+#include <zlib.h>
 #include "romreader.h"
+#include "hash.h"
 
 #define _16KB 16384
 #define  _8KB 8192
@@ -53,7 +64,7 @@ read_file (char *filename)
     {
         fprintf (stderr, "Memory error!");
         fclose (fp);
-        return;
+        return 0;
     }
 
     // read file contents into buffer
@@ -63,10 +74,95 @@ read_file (char *filename)
     return buffer;
 }
 
-void
-read_ines (nes_rom* rom, char* buffer)
+#if defined (_WIN32)
+// No mmap() here, so just read the whole file in
+static byte*
+map_file (char *filename, unsigned int *flen)
+{
+    FILE *fp;
+    byte *buffer;
+
+    fp = fopen (filename, "rb");
+    if (!fp) {
+        fprintf (stderr, "Unable to open %s\n\n", filename);
+        exit (0);
+    }
+    fseek (fp, 0, SEEK_END);
+    *flen = ftell (fp);
+    fseek (fp, 0, SEEK_SET);
+
+    printf ("Opened %s (%u bytes)\n", filename, *flen);
+
+    buffer = (byte*) malloc (*flen + 1);
+    fread (buffer, *flen, 1, fp);
+    fclose (fp);
+
+    return buffer;
+}
+#else
+// Maps the specified file into memory.  The mapping is private
+// (copy-on-write): every process mapping the same ROM shares the
+// page cache copy, and nothing is read or copied until touched.
+static byte*
+map_file (char *filename, unsigned int *flen)
+{
+    int fd;
+    struct stat st;
+    void *image;
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf (stderr, "Unable to open %s\n\n", filename);
+        exit (0);
+    }
+
+    if (fstat (fd, &st) < 0 || st.st_size == 0) {
+        fprintf (stderr, "Unable to read %s\n\n", filename);
+        exit (0);
+    }
+    *flen = (unsigned int) st.st_size;
+
+    printf ("Opened %s (%u bytes)\n", filename, *flen);
+
+    image = mmap (0, *flen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    if (image == MAP_FAILED) {
+        fprintf (stderr, "Unable to map %s\n\n", filename);
+        exit (0);
+    }
+
+    // We are going to walk PRG-ROM soon enough
+    madvise (image, *flen, MADV_WILLNEED);
+
+    return (byte*) image;
+}
+#endif
+
+// Size of the iNES image described by rom's header fields
+static unsigned int
+ines_size (nes_rom* rom)
+{
+    return 16 + (rom->flg_trainer ? 512 : 0)
+              + _16KB * rom->prg_rom_size
+              + _8KB * rom->chr_rom_size
+              + (rom->flg_playchoice ? _8KB : 0);
+}
+
+// Fills in rom from the iNES image in buffer.  Nothing is copied
+// or allocated, so this is safe to call from any thread.  Returns
+// ROM_OK or one of the ROM_* error codes.
+int
+read_ines (nes_rom* rom, byte* buffer, unsigned int flen)
 {
-    char* tmp = buffer;
+    byte* tmp = buffer;
+    unsigned int need;
+
+    // Check for iNES file header
+    if ((flen < 16) || memcmp (buffer, "NES\x1A", 4)) {
+        return ROM_NOT_INES;
+    }
+    memcpy (rom->type, buffer, 3*sizeof(char));
 
     // Read Byte 4
     rom->prg_rom_size = buffer[4];
@@ -75,7 +171,8 @@ read_ines (nes_rom* rom, char* buffer)
     rom->chr_rom_size = buffer[5];
 
     // Read Byte 6 (Flags)
-    rom->flg_mirroring = ((buffer[6] & BIT3) >> 2) | (buffer[6] & BIT0);
+    // (4-screen VRAM overrides the H/V bit)
+    rom->flg_mirroring = (buffer[6] & BIT3) ? MIRROR_FOUR_SCREEN : (buffer[6] & BIT0);
     rom->flg_sram = (buffer[6] & BIT1) >> 1;
     rom->flg_trainer = (buffer[6] & BIT2) >> 2;
     rom->mapper = (buffer[6] & 0xF0) >> 4;
@@ -92,68 +189,428 @@ read_ines (nes_rom* rom, char* buffer)
     // Read Byte 9
     rom->flg_tv = buffer[9] & BIT0;
 
+    if (!rom->prg_rom_size) {
+        return ROM_NO_PRG;
+    }
+
+    // Make sure the file actually holds what the header claims
+    need = ines_size (rom);
+    if (flen < need) {
+        return ROM_TRUNCATED;
+    }
+
     // Skip past the header
     tmp = buffer + 16*sizeof(byte);
 
+    // Trainer, PRG-ROM, CHR-ROM and the hint screen are not copied;
+    // they are simply pointed at within the file image.
+
     // Read Trainer
     if (rom->flg_trainer) {
-        rom->trainer = (byte*) malloc (512*sizeof(byte));
-        memcpy (rom->trainer, tmp, 512*sizeof(byte));
+        rom->trainer = tmp;
 
         // Move to start of PRG-ROM
         tmp += 512*sizeof(byte);
     }
 
     // Read PRG ROM
-    if (rom->prg_rom_size) {
-        rom->prg_rom = (byte*) malloc (_16KB * rom->prg_rom_size * sizeof(byte));
-        memcpy (rom->prg_rom, tmp, _16KB * rom->prg_rom_size * sizeof(byte));
-    } else {
-        printf ("Bad ROM! (No PRG-ROM)\n");
-        exit(0);
-    }
+    rom->prg_rom = tmp;
 
     // Skip to start of CHR ROM
     tmp += _16KB * rom->prg_rom_size * sizeof(byte);
 
-    // Read CHR ROM
+    // Read CHR ROM (0 = board has CHR-RAM, which belongs
+    // to each running instance rather than the ROM)
     if (rom->chr_rom_size) {
-        rom->chr_rom = (byte*) malloc (_8KB * rom->chr_rom_size * sizeof(byte));
-        memcpy (rom->chr_rom, tmp, _8KB * rom->chr_rom_size * sizeof(byte));
-    } else {
-        // No CHR-ROM??
-        // Well... I suppose we /should/ just allocate 8KB anyway
-        // and memset to zeros??
-        rom->chr_rom = (byte*) malloc (_8KB * sizeof(byte));
-        memset (rom->chr_rom, 0, _8KB * sizeof(byte));
+        rom->chr_rom = tmp;
     }
 
-
     // Read PlayChoice Hint Screen
     if (rom->flg_playchoice) {
         tmp += _8KB * rom->chr_rom_size * sizeof(byte);
-        rom->hint_scr = (byte*) malloc (_8KB*sizeof(byte));
-        memcpy (rom->hint_scr, tmp, _8KB*sizeof(byte));
+        rom->hint_scr = tmp;
+    }
+
+    return ROM_OK;
+}
+
+// ---------- compressed images
+
+#define ZIP_LOCAL   0x04034b50
+#define ZIP_CENTRAL 0x02014b50
+#define ZIP_END     0x06054b50
+
+/* Bytes inflated per step; each step's output is hashed while
+ * it is still in cache. */
+#define INFLATE_CHUNK (32*1024)
+
+typedef struct rom_stream_struct rom_stream;
+struct rom_stream_struct {
+    z_stream z;
+    int stored;             // zip entry stored without compression
+    byte *in;               // (stored only) remaining input
+    unsigned int in_left;
+};
+
+static unsigned int
+rd16 (const byte *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int
+rd32 (const byte *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static void
+free_image (byte *image, unsigned int len)
+{
+#if defined (_WIN32)
+    free (image);
+#else
+    munmap (image, len);
+#endif
+}
+
+// Finds the .nes entry of a zip archive (or the first entry if none
+// is named .nes) via the central directory and points the stream at
+// its data.  Returns 0 if there is nothing usable.
+static int
+open_zip_entry (rom_stream *st, byte *zip, unsigned int flen)
+{
+    byte *end = 0;
+    byte *cd, *local, *pick = 0;
+    unsigned int i, n, name_len, len, off;
+    int p;
+
+    // End of central directory record (followed by <= 64KB comment)
+    for (p = (int) flen - 22; p >= 0 && p >= (int) flen - 22 - 65535; p--) {
+        if (rd32 (zip + p) == ZIP_END) {
+            end = zip + p;
+            break;
+        }
+    }
+    if (!end || rd32 (end + 16) >= flen) {
+        return 0;
+    }
+
+    // (all sizes are checked as offsets against what is left of
+    //  the file, so a damaged archive can't walk us off the end)
+    n   = rd16 (end + 10);
+    off = rd32 (end + 16);
+    for (i=0; i<n; i++) {
+        cd = zip + off;
+        if (flen - off < 46 || rd32 (cd) != ZIP_CENTRAL) {
+            return 0;
+        }
+        name_len = rd16 (cd + 28);
+        len = 46 + name_len + rd16 (cd + 30) + rd16 (cd + 32);
+        if (len > flen - off) {
+            return 0;
+        }
+        if (!pick) {
+            pick = cd;
+        }
+        if (name_len > 4 && !strncasecmp ((char*) cd + 46 + name_len - 4, ".nes", 4)) {
+            pick = cd;
+            printf ("Loading %.*s\n", name_len, (char*) cd + 46);
+            break;
+        }
+        off += len;
+    }
+    if (!pick) {
+        return 0;
+    }
+
+    off = rd32 (pick + 42);
+    if (off > flen || flen - off < 30) {
+        return 0;
+    }
+    local = zip + off;
+    if (rd32 (local) != ZIP_LOCAL) {
+        return 0;
+    }
+    len = 30 + rd16 (local + 26) + rd16 (local + 28);
+    if (len > flen - off) {
+        return 0;
+    }
+    off += len;
+    st->in = zip + off;
+    st->in_left = rd32 (pick + 20);
+    if (st->in_left > flen - off) {
+        return 0;
+    }
+
+    switch (rd16 (pick + 10))
+    {
+        case 0:     // stored
+            st->stored = 1;
+            return 1;
+        case 8:     // raw deflate
+            st->z.next_in = st->in;
+            st->z.avail_in = st->in_left;
+            return inflateInit2 (&st->z, -MAX_WBITS) == Z_OK;
+        default:
+            printf ("Bad ROM! (Unsupported zip compression method)\n");
+            exit(0);
+    }
+}
+
+// Produces up to len bytes of the decompressed ROM image at out.
+// Returns the number of bytes produced (short only at end of stream).
+static unsigned int
+stream_read (rom_stream *st, byte *out, unsigned int len)
+{
+    int ret;
+
+    if (st->stored) {
+        if (len > st->in_left) {
+            len = st->in_left;
+        }
+        memcpy (out, st->in, len);
+        st->in += len;
+        st->in_left -= len;
+        return len;
+    }
+
+    st->z.next_out = out;
+    st->z.avail_out = len;
+    while (st->z.avail_out) {
+        ret = inflate (&st->z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+        if (ret != Z_OK) {
+            printf ("Bad ROM! (Corrupt compressed data)\n");
+            exit(0);
+        }
+    }
+
+    return len - st->z.avail_out;
+}
+
+// Loads a gzip or zip compressed ROM.  Only the 16 byte header is
+// inflated on its own; once read_ines knows the layout, the rest is
+// inflated straight into the final image, and each chunk of PRG/CHR
+// is hashed as soon as it lands.
+static void
+read_compressed (nes_rom *rom, byte *file, unsigned int flen)
+{
+    rom_stream st;
+    byte header[16];
+    byte *image, *out, *hash_pos, *hash_end;
+    unsigned int need, got, len;
+    sha1_ctx sha;
+    uint32_t crc = 0;
+    int status;
+
+    memset (&st, 0, sizeof(rom_stream));
+    if (file[0] == 0x1F) {
+        // gzip (zlib parses the gzip header & trailer itself)
+        st.z.next_in = file;
+        st.z.avail_in = flen;
+        if (inflateInit2 (&st.z, 16 + MAX_WBITS) != Z_OK) {
+            printf ("Bad ROM! (Corrupt compressed data)\n");
+            exit(0);
+        }
+    } else if (!open_zip_entry (&st, file, flen)) {
+        printf ("Bad ROM! (No usable zip entry)\n");
+        exit(0);
+    }
+
+    // Header first, so we know how big everything else is
+    if (stream_read (&st, header, 16) != 16) {
+        printf ("Bad ROM! (Not an iNES file)\n");
+        exit(0);
+    }
+    status = read_ines (rom, header, 16);
+    if (status != ROM_TRUNCATED) {
+        // header-only parse either fails outright or wants more data
+        if (status == ROM_NO_PRG) {
+            printf ("Bad ROM! (No PRG-ROM)\n");
+        } else {
+            printf ("Bad ROM! (Not an iNES file)\n");
+        }
+        exit(0);
     }
+    need = ines_size (rom);
+
+    // The final image: same layout as an uncompressed file, so
+    // read_ines can set up the section pointers before any of the
+    // sections have actually been inflated.
+    image = (byte*) malloc (need);
+    memcpy (image, header, 16);
+    read_ines (rom, image, need);
+
+    sha1_init (&sha);
+    hash_pos = rom->prg_rom;
+    hash_end = rom->prg_rom + _16KB * rom->prg_rom_size + _8KB * rom->chr_rom_size;
+
+    for (out = image + 16; out < image + need; out += got) {
+        len = image + need - out;
+        if (len > INFLATE_CHUNK) {
+            len = INFLATE_CHUNK;
+        }
+        got = stream_read (&st, out, len);
+        if (!got) {
+            printf ("Bad ROM! (Truncated: %u of %u bytes)\n", (unsigned int) (out - image), need);
+            exit(0);
+        }
+
+        // Hash whatever part of PRG/CHR this chunk completed
+        if (out + got > hash_pos && hash_pos < hash_end) {
+            len = ((out + got < hash_end) ? out + got : hash_end) - hash_pos;
+            crc = crc32_update (crc, hash_pos, len);
+            sha1_update (&sha, hash_pos, len);
+            hash_pos += len;
+        }
+    }
+
+    if (!st.stored) {
+        inflateEnd (&st.z);
+    }
+
+    rom->crc32 = crc;
+    sha1_final (&sha, rom->sha1);
+    rom->hashed = 1;
 
+    rom->image = image;
+    rom->image_size = need;
+    rom->compressed = 1;
 }
 
+// ----------
+
 nes_rom*
 read_rom (char *filename)
 {
-    char *buffer;
+    byte *buffer;
     nes_rom *rom;
-    char tmp1[4];
+    unsigned int flen;
 
     rom = (nes_rom*) malloc (sizeof(nes_rom));
+    memset (rom, 0, sizeof(nes_rom));
 
-    buffer = read_file (filename);
+    buffer = map_file (filename, &flen);
 
-    // Check for iNES file header
-    memcpy (rom->type, buffer, 3*sizeof(char));
-    if (!(strcmp(rom->type, "NES"))) {
-        read_ines (rom, buffer);
+    if ((flen >= 4) && ((buffer[0] == 0x1F && buffer[1] == 0x8B) ||
+                        !memcmp (buffer, "PK\x03\x04", 4))) {
+        // The compressed file is only needed until it's inflated
+        read_compressed (rom, buffer, flen);
+        free_image (buffer, flen);
+    } else {
+        rom->image = buffer;
+        rom->image_size = flen;
+
+        switch (read_ines (rom, buffer, flen))
+        {
+            case ROM_OK:
+                break;
+            case ROM_NOT_INES:
+                printf ("Bad ROM! (Not an iNES file)\n");
+                exit(0);
+            case ROM_NO_PRG:
+                printf ("Bad ROM! (No PRG-ROM)\n");
+                exit(0);
+            case ROM_TRUNCATED:
+                printf ("Bad ROM! (Truncated: %u bytes)\n", flen);
+                exit(0);
+        }
     }
 
     return rom;
 }
+
+// Computes the CRC32 & SHA-1 of PRG-ROM followed by CHR-ROM (the
+// header is left out, since that is exactly what tends to be wrong).
+// Both hashes are fed the same chunks so each one is still in cache
+// for the second pass.
+void
+hash_rom (nes_rom* rom)
+{
+    sha1_ctx sha;
+    uint32_t crc = 0;
+    unsigned int i, len;
+    byte *p;
+    int part;
+
+    sha1_init (&sha);
+
+    for (part=0; part<2; part++) {
+        if (part == 0) {
+            p = rom->prg_rom;
+            len = _16KB * rom->prg_rom_size;
+        } else {
+            p = rom->chr_rom;
+            len = _8KB * rom->chr_rom_size;     // (CHR-RAM is not hashed)
+        }
+        for (i=0; i<len; i+=_8KB) {
+            crc = crc32_update (crc, p + i, _8KB);
+            sha1_update (&sha, p + i, _8KB);
+        }
+    }
+
+    rom->crc32 = crc;
+    sha1_final (&sha, rom->sha1);
+    rom->hashed = 1;
+}
+
+void
+unload_rom (nes_rom** rom)
+{
+    if ((*rom)->compressed) {
+        free ((*rom)->image);
+    } else {
+        free_image ((*rom)->image, (*rom)->image_size);
+    }
+    free (*rom);
+    *rom = 0;
+}
+
+// Board names for the common iNES mapper numbers
+const char*
+mapper_name (int mapper)
+{
+    switch (mapper)
+    {
+        case 0:  return "NROM";
+        case 1:  return "Nintendo MMC1";
+        case 2:  return "UNROM switch";
+        case 3:  return "CNROM switch";
+        case 4:  return "Nintendo MMC3";
+        case 5:  return "Nintendo MMC5";
+        case 6:  return "FFE F4xxx";
+        case 7:  return "AOROM switch";
+        case 8:  return "FFE F3xxx";
+        case 9:  return "Nintendo MMC2";
+        case 10: return "Nintendo MMC4";
+        case 11: return "ColorDreams chip";
+        case 12: return "FFE F6xxx";
+        case 15: return "100-in-1 switch";
+        case 16: return "Bandai chip";
+        case 17: return "FFE F8xxx";
+        case 18: return "Jaleco SS8806";
+        case 19: return "Namcot 106 chip";
+        case 20: return "Nintendo DiskSystem";
+        case 21: return "Konami VRC4a";
+        case 22: return "Konami VRC2a";
+        case 23: return "Konami VRC2a";
+        case 24: return "Konami VRC6";
+        case 25: return "Konami VRC4b";
+        case 32: return "Irem G-101 chip";
+        case 33: return "Taito TC0190/TC0350";
+        case 34: return "32KB ROM switch";
+        case 64: return "Tengen RAMBO-1 chip";
+        case 65: return "Irem H-3001 chip";
+        case 66: return "GRROM switch";
+        case 67: return "SunSoft3 chip";
+        case 68: return "SunSoft4 chip";
+        case 69: return "SunSoft5 FME-7 chip";
+        case 71: return "Camerica chip";
+        case 78: return "Irem 74HC161/32-based";
+        case 91: return "Pirate HK-SF3 chip";
+        default: return "Unknown";
+    }
+}
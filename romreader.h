@@ -18,8 +18,23 @@
 #ifndef _romreader_h_
 #define _romreader_h_
 
+#include <stdint.h>
 #include "6502_types.h"
 
+/* read_ines() return codes */
+#define ROM_OK          0
+#define ROM_NOT_INES    1
+#define ROM_NO_PRG      2
+#define ROM_TRUNCATED   3
+
+/* Name table mirroring modes (flg_mirroring, set_mirroring).
+ * Headers only give the first 3; the rest are set by boards. */
+#define MIRROR_HORIZONTAL   0
+#define MIRROR_VERTICAL     1
+#define MIRROR_FOUR_SCREEN  2   /* 4KB: 2KB CIRAM + 2KB on the cart */
+#define MIRROR_SINGLE_A     3   /* all 4 tables on CIRAM A          */
+#define MIRROR_SINGLE_B     4   /* all 4 tables on CIRAM B          */
+
 typedef struct NES_ROM_struct nes_rom;
 struct NES_ROM_struct {
     /* Bytes 0 - 3 */
@@ -32,7 +47,8 @@ struct NES_ROM_struct {
     byte chr_rom_size;      // # of  8KB blocks (0 = CHR_RAM, not ROM)
 
     /* From Flag 6 */
-    byte flg_mirroring;     // 0 = horizontal, 1 = vertical, 2 = 4-way)
+    byte flg_mirroring;     // MIRROR_xxx: 0 = horiz., 1 = vert.,
+                            //  2 = 4-screen, 3/4 = single screen A/B
     byte flg_sram;          // 0 = None, 1 = SRAM     (@ $6000-$7FFF)
     byte flg_trainer;       // 0 = None, 1 = Trainter (@ $7000-$71FF)
 
@@ -50,10 +66,21 @@ struct NES_ROM_struct {
     /* From Flag 9 */
     byte flg_tv;            // 0 = NTSC, 1 = PAL
 
+    /* These point straight into the file image */
     byte* trainer;
     byte* prg_rom;
-    byte* chr_rom;
+    byte* chr_rom;          // (0 if chr_rom_size == 0)
     byte* hint_scr;
+
+    /* Backing store */
+    byte* image;            // copy-on-write view of the file, or the
+    unsigned int image_size;//  inflated image of a compressed one
+    byte compressed;        // 1 = image was malloc()ed by the inflater
+
+    /* Content hashes of PRG-ROM + CHR-ROM (see hash_rom) */
+    byte hashed;            // 1 = the fields below are valid
+    uint32_t crc32;
+    byte sha1[20];
 };
 
 
@@ -63,6 +90,10 @@ extern "C" {
 
 char* read_file (char *filename);
 nes_rom* read_rom  (char *filename);
+int read_ines (nes_rom* rom, byte* buffer, unsigned int flen);
+void unload_rom (nes_rom** rom);
+void hash_rom (nes_rom* rom);
+const char* mapper_name (int mapper);
     
 
 #if defined __cplusplus
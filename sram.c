@@ -0,0 +1,158 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sram.h"
+#include "memory.h"
+
+// game.nes -> game.sav  (game.nes.gz -> game.nes.sav)
+static char*
+sav_name (char *rom_file)
+{
+    char *name;
+    char *dot, *slash;
+
+    name = (char*) malloc (strlen (rom_file) + 5);
+    strcpy (name, rom_file);
+
+    dot = strrchr (name, '.');
+    slash = strrchr (name, '/');
+    if (dot && (!slash || dot > slash)) {
+        *dot = '\0';
+    }
+    strcat (name, ".sav");
+
+    return name;
+}
+
+// Flusher thread: wakes every SRAM_SYNC_MS and writes the SRAM
+// back only if the game touched it since the last look.
+static void*
+sram_flusher (void *arg)
+{
+    sram_inst *sramx = (sram_inst*) arg;
+    struct timespec ts;
+
+    pthread_mutex_lock (&sramx->lock);
+    while (!sramx->quit) {
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ts.tv_sec  += SRAM_SYNC_MS / 1000;
+        ts.tv_nsec += (SRAM_SYNC_MS % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait (&sramx->wake, &sramx->lock, &ts);
+
+        // (cleared before the msync: a write that lands during it
+        //  just marks the next round dirty)
+        if (__atomic_exchange_n (&sramx->cpux->sram_dirty, 0, __ATOMIC_ACQUIRE)) {
+            msync (sramx->data, SRAM_SIZE, MS_SYNC);
+            sramx->syncs++;
+        }
+    }
+    pthread_mutex_unlock (&sramx->lock);
+
+    return 0;
+}
+
+// ----------
+
+sram_inst*
+make_sram (char *rom_file, cpu_inst* cpux)
+{
+    sram_inst *sramx;
+    struct stat st;
+    void *map;
+    int fd;
+
+    sramx = (sram_inst*) malloc (sizeof(sram_inst));
+    memset (sramx, 0, sizeof(sram_inst));
+    sramx->filename = sav_name (rom_file);
+    sramx->cpux = cpux;
+
+    fd = open (sramx->filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf (stderr, "sram: unable to open %s (%s), saves will be lost\n",
+                 sramx->filename, strerror (errno));
+        free (sramx->filename);
+        free (sramx);
+        return 0;
+    }
+
+    // A new (or short) file is zero filled up to size
+    if ((fstat (fd, &st) < 0) ||
+        ((st.st_size < SRAM_SIZE) && (ftruncate (fd, SRAM_SIZE) < 0))) {
+        fprintf (stderr, "sram: unable to size %s, saves will be lost\n", sramx->filename);
+        close (fd);
+        free (sramx->filename);
+        free (sramx);
+        return 0;
+    }
+
+    map = mmap (0, SRAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        fprintf (stderr, "sram: unable to map %s, saves will be lost\n", sramx->filename);
+        free (sramx->filename);
+        free (sramx);
+        return 0;
+    }
+    sramx->data = (byte*) map;
+
+    printf ("Battery SRAM: %s\n", sramx->filename);
+
+    // Replace the volatile SRAM block with the file
+    cpux->SRAM = sramx->data;
+    swap_in (cpux->mmap, 0x6000, sramx->data, 0x0000, SRAM_SIZE);
+    cpux->sram_dirty = 0;
+
+    pthread_mutex_init (&sramx->lock, 0);
+    pthread_cond_init (&sramx->wake, 0);
+    pthread_create (&sramx->thread, 0, sram_flusher, sramx);
+
+    return sramx;
+}
+
+
+void
+destroy_sram (sram_inst* sramx)
+{
+    pthread_mutex_lock (&sramx->lock);
+    sramx->quit = 1;
+    pthread_cond_signal (&sramx->wake);
+    pthread_mutex_unlock (&sramx->lock);
+
+    pthread_join (sramx->thread, 0);
+
+    // Final flush, whatever the flag says
+    msync (sramx->data, SRAM_SIZE, MS_SYNC);
+    munmap (sramx->data, SRAM_SIZE);
+
+    pthread_cond_destroy (&sramx->wake);
+    pthread_mutex_destroy (&sramx->lock);
+    free (sramx->filename);
+    free (sramx);
+}
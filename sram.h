@@ -0,0 +1,68 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _sram_h_
+#define _sram_h_
+
+#include <pthread.h>
+#include "6502_types.h"
+#include "6502.h"
+
+#define SRAM_SIZE       8192
+
+/* How often the background thread flushes a dirty SRAM */
+#define SRAM_SYNC_MS    1000
+
+// Battery backed SRAM.  The $6000-$7FFF block is a shared mapping
+// of the game's .sav file, so writes cost nothing extra: write_mem
+// just sets cpux->sram_dirty, and a background thread msync()s the
+// file when it sees the flag (and once more at exit).
+
+typedef struct sram_instance sram_inst;
+struct sram_instance {
+
+    char *filename;         // the .sav file
+    byte *data;             // SRAM_SIZE bytes, mapped from filename
+    cpu_inst *cpux;         // owner of the dirty flag
+
+    /* Flusher thread */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int quit;
+
+    unsigned int syncs;     // # of flushes done
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* Maps <rom_file minus extension>.sav into $6000-$7FFF of cpux
+ * (creating it if needed) and starts the flusher.  Returns 0 and
+ * leaves the volatile SRAM in place if the file can't be used. */
+sram_inst* make_sram (char *rom_file, cpu_inst* cpux);
+
+/* Flushes, stops the flusher and unmaps the file */
+void destroy_sram (sram_inst* sramx);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,182 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "state.h"
+#include "romreader.h"
+#include "memory.h"
+
+size_t
+state_size ()
+{
+    return sizeof(nes_state);
+}
+
+
+size_t
+save_state (cpu_inst* cpux, void *buf, size_t len)
+{
+    nes_state *st = (nes_state*) buf;
+    ppu_inst *ppux = cpux->ppux;
+    nes_rom *romx = cpux->rom0;
+
+    if (len < sizeof(nes_state)) {
+        return 0;
+    }
+
+    // Struct padding & unused fields (CHR_RAM of CHR-ROM carts) are
+    // zeroed so equal states are equal bytes (rewind XORs them)
+    memset (st, 0, sizeof(nes_state));
+
+    memcpy (st->magic, STATE_MAGIC, 4);
+    st->version = STATE_VERSION;
+    st->size    = sizeof(nes_state);
+
+    /* CPU */
+    st->PC = cpux->PC;
+    st->P0 = cpux->P0;
+    st->SP = cpux->SP;
+    st->A  = cpux->A;
+    st->X  = cpux->X;
+    st->Y  = cpux->Y;
+    st->S  = cpux->S;
+    st->OP = cpux->OP;
+    st->D0 = cpux->D0;
+    st->xtra_cycles = cpux->xtra_cycles;
+    st->mapper_id   = cpux->mapper_id;
+    if (cpux->mapper->save) {
+        cpux->mapper->save (cpux);
+    }
+    memcpy (st->mapper_regs, cpux->mapper_regs, MAPPER_REGS);
+    irq_sync (cpux);
+    st->IRQ = cpux->IRQ;
+
+    /* PPU */
+    st->PPUADDR    = ppux->PPUADDR;
+    st->PPULATCH   = ppux->PPULATCH;
+    st->SCROLL     = ppux->SCROLL;
+    st->T0         = ppux->T0;
+    st->PPUCTRL    = ppux->PPUCTRL;
+    st->PPUMASK    = ppux->PPUMASK;
+    st->PPUSTATUS  = ppux->PPUSTATUS;
+    st->OAMADDR    = ppux->OAMADDR;
+    st->OAMDATA    = ppux->OAMDATA;
+    st->PPUDATA    = ppux->PPUDATA;
+    st->FINESCROLL = ppux->FINESCROLL;
+    st->NMI        = ppux->NMI;
+    st->dodma      = ppux->dodma;
+    st->flipflop   = ppux->flipflop;
+    st->latch      = ppux->latch;
+    st->T1         = ppux->T1;
+    st->scanline   = ppux->scanline;
+    st->linecycle  = ppux->linecycle;
+    st->clock      = ppux->clock;
+    st->a12_fell   = ppux->a12_fell;
+    st->a12        = ppux->a12;
+
+    /* Memory */
+    memcpy (st->RAM,      cpux->RAM,      sizeof(st->RAM));
+    memcpy (st->SRAM,     cpux->SRAM,     sizeof(st->SRAM));
+    memcpy (st->EXP,      cpux->EXP,      sizeof(st->EXP));
+    memcpy (st->TABLES,   ppux->TABLES,   sizeof(st->TABLES));
+    memcpy (st->PALETTES, ppux->PALETTES, sizeof(st->PALETTES));
+    memcpy (st->OAM,      ppux->OAM,      sizeof(st->OAM));
+    if (!romx->chr_rom_size) {
+        memcpy (st->CHR_RAM, cpux->mem->CHR_RAM, sizeof(st->CHR_RAM));
+    }
+
+    return sizeof(nes_state);
+}
+
+
+int
+load_state (cpu_inst* cpux, const void *buf, size_t len)
+{
+    const nes_state *st = (const nes_state*) buf;
+    ppu_inst *ppux = cpux->ppux;
+    nes_rom *romx = cpux->rom0;
+    int i;
+
+    if ((len < sizeof(nes_state)) ||
+        memcmp (st->magic, STATE_MAGIC, 4) ||
+        (st->version != STATE_VERSION) ||
+        (st->size != sizeof(nes_state)) ||
+        (st->mapper_id != cpux->mapper_id)) {
+        return -1;
+    }
+
+    /* CPU */
+    cpux->PC = st->PC;
+    cpux->P0 = st->P0;
+    cpux->SP = st->SP;
+    cpux->A  = st->A;
+    cpux->X  = st->X;
+    cpux->Y  = st->Y;
+    cpux->S  = st->S;
+    cpux->OP = st->OP;
+    cpux->D0 = st->D0;
+    cpux->xtra_cycles = st->xtra_cycles;
+    memcpy (cpux->mapper_regs, st->mapper_regs, MAPPER_REGS);
+    for (i=0; i<IRQ_SOURCES; i++) {
+        irq_release (cpux, i);          /* (re-scheduled below) */
+    }
+    cpux->IRQ = st->IRQ;
+
+    /* PPU */
+    ppux->PPUADDR    = st->PPUADDR;
+    ppux->PPULATCH   = st->PPULATCH;
+    ppux->SCROLL     = st->SCROLL;
+    ppux->T0         = st->T0;
+    ppux->PPUCTRL    = st->PPUCTRL;
+    ppux->PPUMASK    = st->PPUMASK;
+    ppux->PPUSTATUS  = st->PPUSTATUS;
+    ppux->OAMADDR    = st->OAMADDR;
+    ppux->OAMDATA    = st->OAMDATA;
+    ppux->PPUDATA    = st->PPUDATA;
+    ppux->FINESCROLL = st->FINESCROLL;
+    ppux->NMI        = st->NMI;
+    ppux->dodma      = st->dodma;
+    ppux->flipflop   = st->flipflop;
+    ppux->latch      = st->latch;
+    ppux->T1         = st->T1;
+    ppux->scanline   = st->scanline;
+    ppux->linecycle  = st->linecycle;
+    ppux->clock      = st->clock;
+    ppux->a12_fell   = st->a12_fell;
+    ppux->a12        = st->a12;
+
+    /* Memory */
+    memcpy (cpux->RAM,      st->RAM,      sizeof(st->RAM));
+    memcpy (cpux->SRAM,     st->SRAM,     sizeof(st->SRAM));
+    __atomic_store_n (&cpux->sram_dirty, 1, __ATOMIC_RELEASE);
+    memcpy (cpux->EXP,      st->EXP,      sizeof(st->EXP));
+    memcpy (ppux->TABLES,   st->TABLES,   sizeof(st->TABLES));
+    memcpy (ppux->PALETTES, st->PALETTES, sizeof(st->PALETTES));
+    memcpy (ppux->OAM,      st->OAM,      sizeof(st->OAM));
+    if (!romx->chr_rom_size) {
+        memcpy (cpux->mem->CHR_RAM, st->CHR_RAM, sizeof(st->CHR_RAM));
+    }
+
+    // Bank selections are plain data in mapper_regs: have the
+    // mapper re-map its banks from them
+    if (cpux->mapper->load) {
+        cpux->mapper->load (cpux);
+    }
+    poll_interrupts (cpux);
+
+    return 0;
+}
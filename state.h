@@ -0,0 +1,105 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _state_h_
+#define _state_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "6502_types.h"
+#include "6502.h"
+#include "2C02.h"
+
+// Save state format.
+//
+// A state is one flat, fixed-size nes_state record in host byte
+// order, so saving & loading are a few dozen register copies plus
+// a memcpy per memory block -- cheap enough to do many times per
+// frame (rewind, run-ahead, rollback).  Bump STATE_VERSION whenever
+// the record changes.
+
+#define STATE_MAGIC     "RBST"
+#define STATE_VERSION   2
+
+typedef struct nes_state_struct nes_state;
+struct nes_state_struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t size;              // sizeof(nes_state)
+
+    /* CPU */
+    uint16_t PC;
+    uint16_t P0;
+    uint8_t SP, A, X, Y, S, OP;
+    uint8_t D0;
+    uint8_t xtra_cycles;
+    uint8_t mapper_id;
+    uint8_t mapper_regs[MAPPER_REGS];
+    uint8_t IRQ;
+    uint8_t cpu_pad[2];
+
+    /* PPU */
+    uint16_t PPUADDR;
+    uint16_t PPULATCH;
+    uint16_t SCROLL;
+    uint16_t T0;
+    uint8_t PPUCTRL, PPUMASK, PPUSTATUS;
+    uint8_t OAMADDR, OAMDATA, PPUDATA;
+    uint8_t FINESCROLL;
+    uint8_t NMI;
+    uint8_t dodma;
+    uint8_t flipflop;
+    uint8_t latch;
+    uint8_t T1;
+    int32_t scanline;
+    int32_t linecycle;
+    uint64_t clock;
+    uint64_t a12_fell;
+    uint8_t a12;
+    uint8_t ppu_pad[7];
+
+    /* Memory */
+    byte RAM[2048];
+    byte SRAM[8192];
+    byte EXP[8192];             // I/O & Expansion area
+    byte TABLES[4096];
+    byte PALETTES[32];
+    byte OAM[256];
+    byte CHR_RAM[8192];         // (only used by CHR-RAM boards)
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* Bytes a save state buffer needs */
+size_t state_size ();
+
+/* Saves the machine into buf.  Returns the # of bytes used,
+ * or 0 if buf is too small. */
+size_t save_state (cpu_inst* cpux, void *buf, size_t len);
+
+/* Restores the machine from buf.  Returns 0 on success or -1
+ * if buf is not a state of this version. */
+int load_state (cpu_inst* cpux, const void *buf, size_t len);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif
@@ -18,21 +18,54 @@
 #include <stdlib.h>
 #include "timer.h"
 
-static double
-get_time (Timer *timer)
+// Monotonic nanosecond clock.  Unlike gettimeofday() this
+// never jumps when the wall clock is adjusted (NTP, etc).
+int64_t
+timer_ns ()
 {
 #if defined (_WIN32)
+    static LARGE_INTEGER clock_freq;
     LARGE_INTEGER clock_count;
+    if (!clock_freq.QuadPart) {
+        QueryPerformanceFrequency (&clock_freq);
+    }
     QueryPerformanceCounter (&clock_count);
-    return ((double) (clock_count.QuadPart)) / ((double) timer->clock_freq.QuadPart);
+    return (int64_t) ((double) clock_count.QuadPart * 1.0e9 / (double) clock_freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+void
+timer_sleep_until (int64_t deadline)
+{
+#if defined (_WIN32)
+    int64_t now = timer_ns ();
+    if (deadline > now) {
+        Sleep ((DWORD) ((deadline - now) / 1000000));
+    }
 #else
-    struct timeval tv;
-    int rc;
-    rc = gettimeofday (&tv, 0);
-    return ((double) tv.tv_sec) + ((double) tv.tv_usec) / 1000000.;
+    struct timespec ts;
+    ts.tv_sec  = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+
+    // Absolute sleep: immune to EINTR re-arming drift
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0)) {
+        if (timer_ns () >= deadline) {
+            break;
+        }
+    }
 #endif
 }
 
+static double
+get_time (Timer *timer)
+{
+    return ((double) timer_ns ()) / 1.0e9;
+}
+
 void
 timer_start (Timer *timer)
 {
@@ -50,4 +83,3 @@ timer_report (Timer *timer)
     current_time = get_time (timer);
     return current_time - timer->start_time;
 }
-
@@ -18,10 +18,12 @@
 #ifndef _timer_h_
 #define _timer_h_
 
+#include <stdint.h>
+
 #ifdef _WIN32
 #include <windows.h>
 #else
-#include <sys/time.h>
+#include <time.h>
 #endif
 
 typedef struct timer_struct Timer;
@@ -39,6 +41,12 @@ extern "C" {
 void timer_start (Timer *timer);
 double timer_report (Timer *timer);
 
+/* Monotonic clock, in nanoseconds */
+int64_t timer_ns ();
+
+/* Sleeps (coarsely) until the monotonic clock reaches deadline */
+void timer_sleep_until (int64_t deadline);
+
 #if defined __cplusplus
 }
 #endif
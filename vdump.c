@@ -0,0 +1,225 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "vdump.h"
+
+#define FRAME_PIXELS (256*240)
+
+// Large stdio buffer so the writer issues few, big write() calls
+#define VDUMP_BUFSIZE (4*1024*1024)
+
+// Expands one queued frame of palette indices into the
+// staging buffer.  Returns the # of bytes to write.
+static size_t
+convert_frame (vdump_inst* vdumpx, unsigned char *frame)
+{
+    unsigned char *out = vdumpx->obuf;
+    unsigned int rgb;
+    int i;
+
+    switch (vdumpx->format)
+    {
+        case VDUMP_Y4M:
+            memcpy (out, "FRAME\n", 6);
+            out += 6;
+
+            // Planar Y, then U, then V
+            for (i=0; i<FRAME_PIXELS; i++) {
+                out[i] = vdumpx->y[frame[i]];
+            }
+            out += FRAME_PIXELS;
+            for (i=0; i<FRAME_PIXELS; i++) {
+                out[i] = vdumpx->u[frame[i]];
+            }
+            out += FRAME_PIXELS;
+            for (i=0; i<FRAME_PIXELS; i++) {
+                out[i] = vdumpx->v[frame[i]];
+            }
+            return 6 + 3*FRAME_PIXELS;
+
+        case VDUMP_RGB:
+        default:
+            for (i=0; i<FRAME_PIXELS; i++) {
+                rgb = vdumpx->rgb[frame[i]];
+                *out++ = (rgb & 0xFF0000) >> 16;
+                *out++ = (rgb & 0x00FF00) >> 8;
+                *out++ = (rgb & 0x0000FF) >> 0;
+            }
+            return 3*FRAME_PIXELS;
+    }
+}
+
+// Writer thread: drains the frame queue until told to quit
+// and the queue is empty.
+static void*
+vdump_writer (void *arg)
+{
+    vdump_inst* vdumpx = (vdump_inst*) arg;
+    unsigned char *frame;
+    size_t len;
+    int error;
+
+    for (;;) {
+        pthread_mutex_lock (&vdumpx->lock);
+        while (!vdumpx->count && !vdumpx->quit) {
+            pthread_cond_wait (&vdumpx->ready, &vdumpx->lock);
+        }
+        if (!vdumpx->count && vdumpx->quit) {
+            pthread_mutex_unlock (&vdumpx->lock);
+            break;
+        }
+        frame = vdumpx->queue + vdumpx->tail * FRAME_PIXELS;
+        error = vdumpx->error;
+        pthread_mutex_unlock (&vdumpx->lock);
+
+        // The slot stays owned by us until tail moves,
+        // so the conversion & write happen unlocked.
+        // (once a write has failed, the rest are dropped)
+        if (!error) {
+            len = convert_frame (vdumpx, frame);
+            if (fwrite (vdumpx->obuf, len, 1, vdumpx->fp) != 1) {
+                fprintf (stderr, "vdump: write error, recording stopped\n");
+                error = 1;
+            }
+        }
+
+        pthread_mutex_lock (&vdumpx->lock);
+        vdumpx->tail = (vdumpx->tail + 1) % VDUMP_QUEUE;
+        vdumpx->count--;
+        if (error) {
+            vdumpx->error = 1;
+            vdumpx->dropped++;
+        } else {
+            vdumpx->frames++;
+        }
+        pthread_mutex_unlock (&vdumpx->lock);
+    }
+
+    return 0;
+}
+
+// ----------
+
+vdump_inst*
+make_vdump (char *filename, int format, unsigned int *palette)
+{
+    vdump_inst *vdumpx;
+    int r, g, b, i;
+
+    vdumpx = (vdump_inst*) malloc (sizeof(vdump_inst));
+    memset (vdumpx, 0, sizeof(vdump_inst));
+
+    vdumpx->format = format;
+
+    if (!strcmp (filename, "-")) {
+        vdumpx->fp = stdout;
+    } else {
+        vdumpx->fp = fopen (filename, "wb");
+    }
+    if (!vdumpx->fp) {
+        fprintf (stderr, "Unable to open %s for video dump\n\n", filename);
+        free (vdumpx);
+        return 0;
+    }
+    setvbuf (vdumpx->fp, 0, _IOFBF, VDUMP_BUFSIZE);
+
+    // Pre-compute RGB & BT.601 (studio range) YUV for each palette entry
+    for (i=0; i<64; i++) {
+        vdumpx->rgb[i] = palette[i];
+        r = (palette[i] & 0xFF0000) >> 16;
+        g = (palette[i] & 0x00FF00) >> 8;
+        b = (palette[i] & 0x0000FF) >> 0;
+        vdumpx->y[i] = 16  + ( 16829*r + 33039*g +  6416*b + 32768) / 65536;
+        vdumpx->u[i] = 128 + (-9714*r - 19070*g + 28784*b + 32768) / 65536;
+        vdumpx->v[i] = 128 + (28784*r - 24103*g -  4681*b + 32768) / 65536;
+    }
+
+    vdumpx->queue = (unsigned char*) malloc (VDUMP_QUEUE * FRAME_PIXELS);
+    vdumpx->obuf  = (unsigned char*) malloc (6 + 3*FRAME_PIXELS);
+
+    if (format == VDUMP_Y4M) {
+        // 60.0988 Hz (NTSC), 8:7 pixel aspect ratio
+        fprintf (vdumpx->fp, "YUV4MPEG2 W256 H240 F39375000:655171 Ip A8:7 C444\n");
+    }
+
+    pthread_mutex_init (&vdumpx->lock, 0);
+    pthread_cond_init (&vdumpx->ready, 0);
+    pthread_create (&vdumpx->thread, 0, vdump_writer, vdumpx);
+
+    return vdumpx;
+}
+
+
+void
+vdump_frame (vdump_inst* vdumpx, unsigned int *pixels)
+{
+    unsigned char *frame;
+    int i;
+
+    // Never stall the emulator: if the writer has fallen
+    // a full queue behind (or can no longer write), this
+    // frame is simply dropped.
+    pthread_mutex_lock (&vdumpx->lock);
+    if ((vdumpx->count == VDUMP_QUEUE) || vdumpx->error) {
+        vdumpx->dropped++;
+        pthread_mutex_unlock (&vdumpx->lock);
+        return;
+    }
+    frame = vdumpx->queue + vdumpx->head * FRAME_PIXELS;
+    pthread_mutex_unlock (&vdumpx->lock);
+
+    // Only we touch the head slot, so copy it unlocked
+    for (i=0; i<FRAME_PIXELS; i++) {
+        frame[i] = pixels[i] & 0x3F;
+    }
+
+    pthread_mutex_lock (&vdumpx->lock);
+    vdumpx->head = (vdumpx->head + 1) % VDUMP_QUEUE;
+    vdumpx->count++;
+    pthread_cond_signal (&vdumpx->ready);
+    pthread_mutex_unlock (&vdumpx->lock);
+}
+
+
+void
+destroy_vdump (vdump_inst* vdumpx)
+{
+    pthread_mutex_lock (&vdumpx->lock);
+    vdumpx->quit = 1;
+    pthread_cond_signal (&vdumpx->ready);
+    pthread_mutex_unlock (&vdumpx->lock);
+
+    pthread_join (vdumpx->thread, 0);
+
+    fflush (vdumpx->fp);
+    if (vdumpx->fp != stdout) {
+        fclose (vdumpx->fp);
+    }
+
+    fprintf (stderr, "vdump: %u frames written, %u dropped\n",
+             vdumpx->frames, vdumpx->dropped);
+
+    pthread_cond_destroy (&vdumpx->ready);
+    pthread_mutex_destroy (&vdumpx->lock);
+    free (vdumpx->obuf);
+    free (vdumpx->queue);
+    free (vdumpx);
+}
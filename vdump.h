@@ -0,0 +1,82 @@
+/*  This file is part of retrobox
+    Copyright (C) 2010  James A. Shackleford
+
+    retrobox is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _vdump_h_
+#define _vdump_h_
+
+#include <stdio.h>
+#include <pthread.h>
+
+/* Output container formats */
+#define VDUMP_RGB   0       /* headerless packed RGB24       */
+#define VDUMP_Y4M   1       /* YUV4MPEG2, 4:4:4 planar       */
+
+/* # of frames the emulator may get ahead of the writer */
+#define VDUMP_QUEUE 32
+
+typedef struct vdump_instance vdump_inst;
+struct vdump_instance {
+
+    int format;             // VDUMP_RGB or VDUMP_Y4M
+    FILE *fp;               // output stream (may be stdout)
+
+    /* Palette LUTs (built from the display palette) */
+    unsigned int rgb[64];
+    unsigned char y[64], u[64], v[64];
+
+    /* Bounded frame queue.  Frames are stored as
+     * raw NES palette indices (1 byte / pixel) and
+     * expanded to RGB/YUV by the writer thread. */
+    unsigned char *queue;
+    int head;               // next slot the emulator fills
+    int tail;               // next slot the writer drains
+    int count;              // # of queued frames
+    int quit;
+    int error;              // set by the 1st failed write
+
+    /* Statistics */
+    unsigned int frames;    // frames written
+    unsigned int dropped;   // frames lost to a full queue
+
+    /* Writer thread */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+
+    /* Output staging buffer (one converted frame) */
+    unsigned char *obuf;
+};
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+    /* Opens filename ("-" for stdout) and starts the writer thread */
+    vdump_inst* make_vdump (char *filename, int format, unsigned int *palette);
+
+    /* Queues a completed 256x240 frame (never blocks) */
+    void vdump_frame (vdump_inst* vdumpx, unsigned int *pixels);
+
+    /* Drains the queue, stops the writer and closes the stream */
+    void destroy_vdump (vdump_inst* vdumpx);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif